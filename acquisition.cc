@@ -25,6 +25,7 @@
 #include <cstdlib>
 
 #include "TriggeredAcquisition.hh"
+#include "SimulatedFPGAInterface.hh"
 
 void usage() {
       std::cout << "Usage:" << std::endl;
@@ -47,13 +48,39 @@ void usage() {
       std::cout << "   -l <tracelength>       set total length of single trace" << std::endl;
       std::cout << "                          (includes <pretriggerlength>)" << std::endl;
       std::cout << "   -o <outputmethod>      set output method, details below" << std::endl;
+      std::cout << "   -m <acqmethod>         set acquisition method, details below" << std::endl;
+      std::cout << "   -B <traces>            number of traces written at once (output method 3)" << std::endl;
+      std::cout << "   -C <samples>           capture <samples> per trigger and extract every event in them" << std::endl;
+      std::cout << "                          with the software trigger (acquisition method 0, 1 or 3)" << std::endl;
+      std::cout << "   -j <samples>           holdoff of the software trigger (acquisition method 4, -C)" << std::endl;
+      std::cout << "                          (default <tracelength> - <pretriggerlength>)" << std::endl;
+      std::cout << "   -M <MB>                memory for burst capture (acquisition method 3, default 64)" << std::endl;
+      std::cout << "   -P                     use huge pages for burst capture" << std::endl;
+      std::cout << "   -w <kB> <buffers>      size and number of output buffers (default 1024 kB, 4)" << std::endl;
+      std::cout << "   -D                     write output file with O_DIRECT (bypass page cache)" << std::endl;
+      std::cout << "   -y <buffers>           fdatasync output file every <buffers> buffers (default never)" << std::endl;
+      std::cout << "   -A <MB>                preallocate <MB> for the output file" << std::endl;
       std::cout << "   -r <min> <max> <s> <e> Rejection parameters for integration (see below)" << std::endl;
+      std::cout << "   -H <bins> <min> <max>  binning of the integral spectrum (output method 7)" << std::endl;
+      std::cout << "   -k                     also histogram the peak amplitude (output method 7)" << std::endl;
+      std::cout << "   -S <seconds>           interval of spectrum snapshots (output method 7)" << std::endl;
       //std::cout << "   -s <min> <max> <s> <e> <tilt> Rejection parameters for improved rej/integ (see below)" << std::endl;
       std::cout << "   -c                     acquire 100 traces for calibration" << std::endl;
       std::cout << "   -a <offset>            offset (in bins) for channel A" << std::endl;
       std::cout << "   -b <offset>            offset (in bins) for channel B" << std::endl;
       std::cout << "   -i <channel>           0 for channel A, 1 for channel B, 2 for both channels" << std::endl;
+      std::cout << "   -x <mode> <w> <v>      coincidence filter, keep events with (1) or without (2) a channel B" << std::endl;
+      std::cout << "                          pulse beyond <v> (-8192 to 8191) within <w> samples of the trigger" << std::endl;
+      std::cout << "   -W <strategy> <s>      wait for the trigger with <strategy> (see below), give up after" << std::endl;
+      std::cout << "                          <s> seconds without trigger (default 10, 0 for never)" << std::endl;
+      std::cout << "   -U <device>            UIO device of the trigger interrupt (e.g. /dev/uio0, strategy 3)" << std::endl;
+      std::cout << "   -Q <core> <priority>   real-time loop: pin to <core> (-1 any), SCHED_FIFO <priority> (0 keep)," << std::endl;
+      std::cout << "                          lock and prefault memory, loop jitter to <filename>.jitter" << std::endl;
       std::cout << "   -g                     Run PMT as counter (no traces are written)" << std::endl;
+      std::cout << "   -R <seconds>           interval of the count rates written to <filename>.rate (with -g, default 1)" << std::endl;
+      std::cout << "   -T <bins> <max>        binning of the times between counts in us (with -g, default 1000 bins up to 10000)" << std::endl;
+      std::cout << "   -e <rate>              use simulated oscilloscope with <rate> pulses/s instead of FPGA" << std::endl;
+      std::cout << "   -E <file>              keep memory of simulated oscilloscope in <file> (with -e)" << std::endl;
       std::cout << std::endl;
       std::cout << std::endl;
       std::cout << "Trigerring methods:" << std::endl;
@@ -68,8 +95,25 @@ void usage() {
       std::cout << "Output methods:" << std::endl;
       std::cout << " " << WRITE_OFF_ASCII_SINGLE << "   Ascii file, write every data point separately" << std::endl;
       std::cout << " " << WRITE_OFF_BINARY_SINGLE << "   Binary file, write every data point separately" << std::endl;
+      std::cout << " " << WRITE_OFF_BINARY_TRACE << "   Compact binary trace file (delta + varint encoded, read with tracedecode)" << std::endl;
+      std::cout << " " << WRITE_OFF_BINARY_MUL << "   Binary file, like 1, but traces are written in batches (see -B)" << std::endl;
       std::cout << " " << WRITE_OFF_ASCII_INTEGRAL << "   Ascii file, write integral over peak, baseline substracted, simple double rejection" << std::endl;
       std::cout << " " << WRITE_OFF_JUST_CHECK << "   No output, just some information on measured data (recommended use with -n)" << std::endl;
+      std::cout << " " << WRITE_OFF_BINARY_INTEGRAL << "   Binary file, fixed size records of integral, peak, baseline and flags (like 4)" << std::endl;
+      std::cout << " " << WRITE_OFF_HISTOGRAM << "   Spectrum of integrals (like 4) in memory, snapshots to <filename>.spectrum" << std::endl;
+      std::cout << " " << std::endl;
+      std::cout << "Acquisition methods:" << std::endl;
+      std::cout << " " << ACQ_DIRECT << "   Process trace in FPGA memory, re-arm afterwards" << std::endl;
+      std::cout << " " << ACQ_COPY_OUT << "   Copy trace out of FPGA memory, re-arm before processing" << std::endl;
+      std::cout << " " << ACQ_PIPELINE << "   Acquisition and processing on separate threads (two cores)" << std::endl;
+      std::cout << " " << ACQ_BURST << "   Capture traces into memory (see -M), process and write them after the measurement" << std::endl;
+      std::cout << " " << ACQ_STREAM << "   Free running oscilloscope, software trigger (edge and level from -t and -v / -u, see -j)" << std::endl;
+      std::cout << " " << std::endl;
+      std::cout << "Trigger wait strategies:" << std::endl;
+      std::cout << " " << WAIT_SPIN << "   Poll the trigger continuously (default, lowest latency, one core busy)" << std::endl;
+      std::cout << " " << WAIT_YIELD << "   Poll, then yield the core between polls" << std::endl;
+      std::cout << " " << WAIT_SLEEP << "   Poll, then sleep with exponential backoff (1 us to 1 ms)" << std::endl;
+      std::cout << " " << WAIT_INTERRUPT << "   Poll, then wait for the trigger interrupt (see -U, like 2 without)" << std::endl;
       std::cout << " " << std::endl;
       std::cout << "Rejection Parameters:" << std::endl;
       std::cout << "With the -r <min> <max> <s> <e> option, will reject detected peaks if " << std::endl;
@@ -92,6 +136,11 @@ int main(int argc, char **argv)
   int tracelength = 256;
   int pretriggerlength = 0;
   bool counter = false;
+  bool peakhistogram = false;
+  bool simulate = false;
+  double simrate = 0;
+  std::string simfile = "";
+  std::string irqdevice = "";
   
   for ( int i=1; i<argc; i=i+1 ) {
     if ( std::string(argv[i]) == "-h" || std::string(argv[i]) == "--help") {
@@ -144,7 +193,7 @@ int main(int argc, char **argv)
     else if ( std::string(argv[i]) == "-o" ) {
       i++;
       int wotmp = std::atoi(argv[i]);
-      if(wotmp >= 0 && wotmp < 6) {
+      if(wotmp >= 0 && wotmp < 8) {
 	ta->SetWriteOff((WriteOffSetting) wotmp);
       }
       else {
@@ -152,6 +201,43 @@ int main(int argc, char **argv)
 	exit(-2);
       }
     }
+    else if ( std::string(argv[i]) == "-m" ) {
+      i++;
+      int amtmp = std::atoi(argv[i]);
+      if(amtmp >= 0 && amtmp <= ACQ_STREAM) {
+	ta->SetAcquisition((AcquisitionSetting) amtmp);
+      }
+      else {
+	std::cout << "Error: Not a valid acquisition method. Run 'acquire -h' to see help." << std::endl;
+	exit(-2);
+      }
+    }
+    else if ( std::string(argv[i]) == "-i" ) {
+      i++;
+      int chtmp = std::atoi(argv[i]);
+      if(chtmp >= CHANNEL_A && chtmp <= CHANNEL_BOTH) {
+	ta->SetChannel((ChannelSetting) chtmp);
+      }
+      else {
+	std::cout << "Error: Not a valid channel. Run 'acquire -h' to see help." << std::endl;
+	exit(-2);
+      }
+    }
+    else if ( std::string(argv[i]) == "-x" ) {
+      i++;
+      int cotmp = std::atoi(argv[i]);
+      i++;
+      int window = std::atoi(argv[i]);
+      i++;
+      int threshold = std::atoi(argv[i]);
+      if(cotmp >= COINC_OFF && cotmp <= COINC_VETO) {
+	ta->SetCoincidence((CoincidenceSetting) cotmp, window, threshold);
+      }
+      else {
+	std::cout << "Error: Not a valid coincidence mode. Run 'acquire -h' to see help." << std::endl;
+	exit(-2);
+      }
+    }
     else if (std::string(argv[i]) == "-r") {
       i++;
       float rmin = std::atof(argv[i]);
@@ -176,14 +262,129 @@ int main(int argc, char **argv)
       float tilt = std::atof(argv[i]);
       ta->SetRejectionParameters(rmin, rmax, cstart, cend, tilt);
     }
+    else if (std::string(argv[i]) == "-B") {
+      i++;
+      ta->SetMulBatch(std::atoi(argv[i]));
+    }
+    else if (std::string(argv[i]) == "-C") {
+      i++;
+      ta->SetCaptureLength(std::atoi(argv[i]));
+    }
+    else if (std::string(argv[i]) == "-j") {
+      i++;
+      ta->SetHoldoff(std::atoi(argv[i]));
+    }
+    else if (std::string(argv[i]) == "-M") {
+      i++;
+      ta->SetBurstMemory(std::atoi(argv[i]));
+    }
+    else if (std::string(argv[i]) == "-P") {
+      ta->SetBurstHugePages(true);
+    }
+    else if (std::string(argv[i]) == "-w") {
+      WriterSettings ws = ta->GetWriterSettings();
+      i++;
+      ws.buffersize = std::atoi(argv[i]) * 1024;
+      i++;
+      ws.buffers = std::atoi(argv[i]);
+      ta->SetWriterSettings(ws);
+    }
+    else if (std::string(argv[i]) == "-D") {
+      WriterSettings ws = ta->GetWriterSettings();
+      ws.direct = true;
+      ta->SetWriterSettings(ws);
+    }
+    else if (std::string(argv[i]) == "-y") {
+      WriterSettings ws = ta->GetWriterSettings();
+      i++;
+      ws.syncinterval = std::atoi(argv[i]);
+      ta->SetWriterSettings(ws);
+    }
+    else if (std::string(argv[i]) == "-A") {
+      WriterSettings ws = ta->GetWriterSettings();
+      i++;
+      ws.preallocate = (uint64_t) (std::atof(argv[i]) * 1024 * 1024);
+      ta->SetWriterSettings(ws);
+    }
+    else if (std::string(argv[i]) == "-H") {
+      i++;
+      int bins = std::atoi(argv[i]);
+      i++;
+      float hmin = std::atof(argv[i]);
+      i++;
+      float hmax = std::atof(argv[i]);
+      ta->SetHistogram(bins, hmin, hmax);
+    }
+    else if (std::string(argv[i]) == "-k") {
+      peakhistogram = true;
+    }
+    else if (std::string(argv[i]) == "-S") {
+      i++;
+      ta->SetSnapshotInterval(std::atof(argv[i]));
+    }
     else if (std::string(argv[i]) == "-g") {
       counter = true;
     }
+    else if (std::string(argv[i]) == "-R") {
+      i++;
+      ta->SetRateInterval(std::atof(argv[i]));
+    }
+    else if (std::string(argv[i]) == "-T") {
+      i++;
+      int bins = std::atoi(argv[i]);
+      i++;
+      double tmax = std::atof(argv[i]);
+      ta->SetIntervalHistogram(bins, tmax);
+    }
+    else if (std::string(argv[i]) == "-W") {
+      WaitSettings ws = ta->GetWaitSettings();
+      i++;
+      ws.strategy = (WaitStrategy) std::atoi(argv[i]);
+      i++;
+      ws.timeout = std::atof(argv[i]);
+      ta->SetWaitSettings(ws);
+    }
+    else if (std::string(argv[i]) == "-Q") {
+      RealtimeSettings rs = ta->GetRealtimeSettings();
+      rs.enabled = true;
+      i++;
+      rs.core = std::atoi(argv[i]);
+      i++;
+      rs.priority = std::atoi(argv[i]);
+      ta->SetRealtimeSettings(rs);
+    }
+    else if (std::string(argv[i]) == "-U") {
+      i++;
+      irqdevice = std::string(argv[i]);
+    }
+    else if (std::string(argv[i]) == "-e") {
+      i++;
+      simulate = true;
+      simrate = std::atof(argv[i]);
+    }
+    else if (std::string(argv[i]) == "-E") {
+      i++;
+      simfile = std::string(argv[i]);
+    }
+  }
+
+  SimulatedFPGAInterface * sim = NULL;
+  if(simulate) {
+    sim = new SimulatedFPGAInterface(simfile);
+    sim->SetPulseRate(simrate);
+    if(ta->GetTrigger() == TRIG_A_POS_EDGE || ta->GetTrigger() == TRIG_B_POS_EDGE) {
+      sim->SetPolarity(1);
+    }
+    ta->SetInterface(sim);
   }
   ta->SetTracelength(tracelength);
   ta->SetPretriggerlength(pretriggerlength);
+  ta->SetPeakHistogram(peakhistogram);
 
   ta->Init();
+  if(irqdevice != "") {
+    ta->GetInterface()->OpenInterrupt(irqdevice);
+  }
     
   float length = atof(argv[argc - 1]);
   if(counter) {
@@ -195,6 +396,9 @@ int main(int argc, char **argv)
     ta->DumpSettings();
     ta->Measure(length, mt);
   }
+  if(sim) {
+    sim->DumpStatistics();
+  }
 
   // Cleanup
   delete ta;
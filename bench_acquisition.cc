@@ -0,0 +1,409 @@
+/*
+ * acquisition - RedPitaya Data Acquisition
+ *
+ *
+ * Copyright (C) 2016, 2017 Moritz Kütt, Malte Göttsche, Alexander Glaser
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: moritz@nuclearfreesoftware.org
+ */
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <cmath>
+#include <vector>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "TriggeredAcquisition.hh"
+#include "TraceKernels.hh"
+#include "TextFormat.hh"
+
+typedef std::chrono::steady_clock benchclock;
+
+static volatile int32_t sink;
+
+void usage() {
+      std::cout << "Usage:" << std::endl;
+      std::cout << "bench_acquisition [options]" << std::endl;
+      std::cout << std::endl;
+      std::cout << "Options:" << std::endl;
+      std::cout << "   -n <iterations>        number of traces per measurement (default 20000)" << std::endl;
+      std::cout << "   -fpga                  read from the FPGA channel A memory (Red Pitaya only)" << std::endl;
+      std::cout << std::endl;
+      std::cout << "Output methods, synthetic pulse train:" << std::endl;
+      std::cout << "   -f <filename>          output file of the output methods (default /tmp/bench_acquisition)" << std::endl;
+      std::cout << "   -l <tracelength>       trace length (default 384)" << std::endl;
+      std::cout << "   -p <pretriggerlength>  pretrigger length (default 64)" << std::endl;
+      std::cout << "   -amplitude <channels>  pulse height (default 2000)" << std::endl;
+      std::cout << "   -rise <ns>             rise time constant (default 20)" << std::endl;
+      std::cout << "   -decay <ns>            decay time constant (default 400)" << std::endl;
+      std::cout << "   -noise <channels>      rms noise (default 3)" << std::endl;
+      std::cout << "   -pileup <fraction>     fraction of traces with a second pulse (default 0.05)" << std::endl;
+      std::cout << "   -r <min> <max>         rejection parameters like 'acquisition -r' (default no rejection)" << std::endl;
+}
+
+/** Synthetic detector signal for the output method benchmark */
+struct PulseTrain {
+  int amplitude;
+  double risetime;   // ns
+  double decaytime;  // ns
+  double noise;      // rms, ADC channels
+  double pileup;     // fraction of events with a second pulse in the trace
+};
+
+static double Gauss() {
+  double u1 = (rand() + 1.0) / (RAND_MAX + 2.0);
+  double u2 = (rand() + 1.0) / (RAND_MAX + 2.0);
+  return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+/**
+ * Fills a fake channel memory with negative pulses, one every tracelength
+ * samples (pile-up pulses at a random later position), and returns the
+ * trigger pointers. Samples are stored like the FPGA: 14 bit two's
+ * complement in 32 bit words.
+ */
+static std::vector<int> FillPulseTrain(uint32_t * ring, const PulseTrain & pt, int tracelength, int pretriggerlength) {
+  double nspersample = 1e9 / ADCSAMPLERATE;
+  std::vector<double> signal(BUF, 0.0);
+  std::vector<int> triggers;
+  srand(3);
+  int spacing = tracelength > 64 ? tracelength : 64;
+  for(int start = pretriggerlength; start + tracelength - pretriggerlength <= BUF; start += spacing) {
+    triggers.push_back(start);
+    int pulses = (rand() < pt.pileup * RAND_MAX) ? 2 : 1;
+    for(int k = 0; k < pulses; k++) {
+      int t0 = start;
+      if(k > 0) {
+	t0 += 1 + rand() % (tracelength - pretriggerlength);
+      }
+      double a = pt.amplitude * (1 + 0.05 * Gauss());
+      for(int i = t0; i < BUF; i++) {
+	double t = (i - t0) * nspersample;
+	double v = a * (exp(-t / pt.decaytime) - exp(-t / pt.risetime));
+	if(t > 10 * pt.decaytime) {
+	  break;
+	}
+	signal[i] -= v;
+      }
+    }
+  }
+  for(int i = 0; i < BUF; i++) {
+    int v = (int) floor(signal[i] + pt.noise * Gauss() + 0.5);
+    if(v > 8191) {
+      v = 8191;
+    }
+    if(v < -8192) {
+      v = -8192;
+    }
+    ring[i] = v & 0x3FFF;
+  }
+  return triggers;
+}
+
+/** Output methods in isolation: ns/event, events/s and bytes/event */
+void BenchWriters(const PulseTrain & pt, int tracelength, int pretriggerlength, float rejectmin, float rejectmax,
+		  std::string filename, int iterations) {
+  const WriteOffSetting methods[] = {
+    WRITE_OFF_BINARY_SINGLE, WRITE_OFF_ASCII_SINGLE, WRITE_OFF_ASCII_INTEGRAL, WRITE_OFF_JUST_CHECK,
+    WRITE_OFF_BINARY_MUL, WRITE_OFF_BINARY_TRACE, WRITE_OFF_BINARY_INTEGRAL, WRITE_OFF_HISTOGRAM
+  };
+  const char * suffixes[] = {".bin", ".txt", ".txt", "", ".bin", ".trc", ".ibin", ""};
+  uint32_t * ring = NULL;
+  if(posix_memalign((void **) &ring, 64, BUF * sizeof(uint32_t)) != 0) {
+    return;
+  }
+  std::vector<int> triggers = FillPulseTrain(ring, pt, tracelength, pretriggerlength);
+
+  std::cout << "*** Output methods (" << tracelength << " samples per trace, " << triggers.size() << " pulses in the ring, "
+	    << pt.pileup * 100 << " % pile-up)" << std::endl;
+  printf("%8s %12s %12s %12s %10s\n", "method", "ns/event", "events/s", "bytes/event", "rejected");
+  for(int m = 0; m < 8; m++) {
+    TriggeredAcquisition ta;
+    ta.SetVerboseLevel(0);
+    ta.SetTracelength(tracelength);
+    ta.SetPretriggerlength(pretriggerlength);
+    if(rejectmax > 0) {
+      ta.SetRejectionParameters(rejectmin, rejectmax, pretriggerlength, tracelength - 1);
+    }
+    ta.SetWriteOff(methods[m]);
+    ta.SetFilename(filename);
+
+    benchclock::time_point t0 = benchclock::now();
+    int rejected = ta.Replay(ring, triggers.data(), triggers.size(), iterations);
+    double ns = std::chrono::duration<double, std::nano>(benchclock::now() - t0).count() / iterations;
+    if(rejected < 0) {
+      continue;
+    }
+    double bytes = 0;
+    struct stat st;
+    if(suffixes[m][0] && stat((filename + suffixes[m]).c_str(), &st) == 0) {
+      bytes = (double) st.st_size / iterations;
+      remove((filename + suffixes[m]).c_str());
+    }
+    printf("%8d %12.1f %12.0f %12.1f %10d\n", (int) methods[m], ns, 1e9 / ns, bytes, rejected);
+  }
+  std::cout << std::endl;
+  free(ring);
+}
+
+/** Trace extraction as done before, one modulo and branch per sample */
+static void ExtractModulo(const uint32_t * src, int start, int n, int16_t * dest) {
+  for (int i=0; i < n; i++) {
+    uint32_t v = src[(start+i)%BUF];
+    if(v >= 8192) {
+      dest[i] = v - 16384;
+    }
+    else {
+      dest[i] = v;
+    }
+  }
+}
+
+/** Trace extraction: ns per trace and MB/s read from the ring */
+void BenchExtraction(const uint32_t * ring, int iterations) {
+  const int lengths[] = {256, 384, 1024, 16383};
+  int16_t * dest = NULL;
+  if(posix_memalign((void **) &dest, 64, BUF * sizeof(int16_t)) != 0) {
+    return;
+  }
+
+  std::cout << "*** Trace extraction" << std::endl;
+  printf("%8s %16s %10s %16s %10s\n", "length", "modulo ns/trace", "MB/s", "burst ns/trace", "MB/s");
+  for(int l = 0; l < 4; l++) {
+    int n = lengths[l];
+    int iter = iterations * 256 / n + 1;
+    double ns[2];
+    for(int method = 0; method < 2; method++) {
+      uint32_t start = 12345;
+      benchclock::time_point t0 = benchclock::now();
+      for(int it = 0; it < iter; it++) {
+	// Trigger positions spread over the ring, so some traces wrap
+	start = (start * 1103515245 + 12345) % BUF;
+	if(method == 0) {
+	  ExtractModulo(ring, start, n, dest);
+	}
+	else {
+	  ExtractTrace(ring, BUF, start, n, dest);
+	}
+	sink += dest[n - 1];
+      }
+      ns[method] = std::chrono::duration<double, std::nano>(benchclock::now() - t0).count() / iter;
+    }
+    printf("%8d %16.1f %10.1f %16.1f %10.1f\n", n,
+	   ns[0], n * sizeof(uint32_t) / ns[0] * 1e3,
+	   ns[1], n * sizeof(uint32_t) / ns[1] * 1e3);
+  }
+  std::cout << std::endl;
+  free(dest);
+}
+
+/** ASCII output: fprintf per sample against the text formatter, written to /dev/null */
+void BenchText(const uint32_t * ring, int iterations) {
+  const int n = 384;
+  int16_t * tr = NULL;
+  if(posix_memalign((void **) &tr, 64, BUF * sizeof(int16_t)) != 0) {
+    return;
+  }
+  char * text = (char *) malloc(BUF * MAXTEXTSAMPLE + 1);
+  char * ref = (char *) malloc(BUF * MAXTEXTSAMPLE + 64);
+  FILE * null = fopen("/dev/null", "w");
+  if(!null) {
+    return;
+  }
+
+  // Check that the output is identical to printf
+  long mismatches = 0;
+  for(int it = 0; it < 1000; it++) {
+    ExtractTrace(ring, BUF, (it * 997) % BUF, n, tr);
+    int len = FormatTrace(tr, n, text);
+    int rlen = 0;
+    for(int i = 0; i < n; i++) {
+      rlen += sprintf(ref + rlen, "%d ", RawSample(tr[i]));
+    }
+    rlen += sprintf(ref + rlen, "\n");
+    if(len != rlen || memcmp(text, ref, len) != 0) {
+      mismatches++;
+    }
+  }
+  srand(2);
+  for(int it = 0; it < 100000; it++) {
+    double v = (rand() - RAND_MAX / 2) / 25.0 * (1 + it % 7);
+    if(it % 3 == 0) {
+      v = (rand() - RAND_MAX / 2) * 1e-7;
+    }
+    char * end = FormatFixed(text, v);
+    int rlen = sprintf(ref, "%f", v);
+    if(end - text != rlen || memcmp(text, ref, rlen) != 0) {
+      mismatches++;
+    }
+  }
+
+  std::cout << "*** ASCII output (" << n << " samples per trace)" << std::endl;
+  printf("%10s %18s %18s\n", "", "fprintf traces/s", "format traces/s");
+  double rate[2];
+  for(int method = 0; method < 2; method++) {
+    benchclock::time_point t0 = benchclock::now();
+    for(int it = 0; it < iterations; it++) {
+      ExtractTrace(ring, BUF, (it * 997) % BUF, n, tr);
+      if(method == 0) {
+	for (int i=0; i < n; i++) {
+	  fprintf(null, "%d ", RawSample(tr[i]));
+	}
+	fprintf(null, "\n");
+      }
+      else {
+	int len = FormatTrace(tr, n, text);
+	fwrite(text, 1, len, null);
+      }
+    }
+    rate[method] = iterations / std::chrono::duration<double>(benchclock::now() - t0).count();
+  }
+  printf("%10s %18.0f %18.0f\n", "traces", rate[0], rate[1]);
+
+  for(int method = 0; method < 2; method++) {
+    benchclock::time_point t0 = benchclock::now();
+    for(int it = 0; it < iterations * 10; it++) {
+      double total = -72000.0 + it / 25.0;
+      if(method == 0) {
+	fprintf(null, "%f\n", total);
+      }
+      else {
+	char * p = FormatFixed(text, total);
+	*p++ = '\n';
+	fwrite(text, 1, p - text, null);
+      }
+    }
+    rate[method] = iterations * 10 / std::chrono::duration<double>(benchclock::now() - t0).count();
+  }
+  printf("%10s %18.0f %18.0f\n", "integrals", rate[0], rate[1]);
+  std::cout << "Mismatches against printf: " << mismatches << std::endl;
+  std::cout << std::endl;
+  fclose(null);
+  free(ref);
+  free(text);
+  free(tr);
+}
+
+int main(int argc, char **argv)
+{
+  int iterations = 20000;
+  bool fpga = false;
+  std::string filename = "/tmp/bench_acquisition";
+  int tracelength = 384;
+  int pretriggerlength = 64;
+  PulseTrain pt;
+  pt.amplitude = 2000;
+  pt.risetime = 20;
+  pt.decaytime = 400;
+  pt.noise = 3;
+  pt.pileup = 0.05;
+  float rejectmin = 0;
+  float rejectmax = 0;
+
+  for ( int i=1; i<argc; i=i+1 ) {
+    if ( std::string(argv[i]) == "-h" || std::string(argv[i]) == "--help") {
+      usage();
+      return 0;
+    }
+    else if ( std::string(argv[i]) == "-n" ) {
+      i++;
+      iterations = std::atoi(argv[i]);
+    }
+    else if ( std::string(argv[i]) == "-fpga" ) {
+      fpga = true;
+    }
+    else if ( std::string(argv[i]) == "-f" ) {
+      i++;
+      filename = argv[i];
+    }
+    else if ( std::string(argv[i]) == "-l" ) {
+      i++;
+      tracelength = std::atoi(argv[i]);
+    }
+    else if ( std::string(argv[i]) == "-p" ) {
+      i++;
+      pretriggerlength = std::atoi(argv[i]);
+    }
+    else if ( std::string(argv[i]) == "-amplitude" ) {
+      i++;
+      pt.amplitude = std::atoi(argv[i]);
+    }
+    else if ( std::string(argv[i]) == "-rise" ) {
+      i++;
+      pt.risetime = std::atof(argv[i]);
+    }
+    else if ( std::string(argv[i]) == "-decay" ) {
+      i++;
+      pt.decaytime = std::atof(argv[i]);
+    }
+    else if ( std::string(argv[i]) == "-noise" ) {
+      i++;
+      pt.noise = std::atof(argv[i]);
+    }
+    else if ( std::string(argv[i]) == "-pileup" ) {
+      i++;
+      pt.pileup = std::atof(argv[i]);
+    }
+    else if ( std::string(argv[i]) == "-r" ) {
+      rejectmin = std::atof(argv[i+1]);
+      rejectmax = std::atof(argv[i+2]);
+      i += 2;
+    }
+  }
+
+  DevMemFPGAInterface * iface = NULL;
+  uint32_t * ring = NULL;
+  if(fpga) {
+    iface = new DevMemFPGAInterface();
+    if(iface->initOscilloscope()) {
+      std::cout << "Error: OSC FPGA initialization didn't work" << std::endl;
+      return -1;
+    }
+    ring = iface->GetOscilloscopeChannelA();
+  }
+  else {
+    if(posix_memalign((void **) &ring, 64, BUF * sizeof(uint32_t)) != 0) {
+      return -1;
+    }
+    srand(1);
+    for(int i = 0; i < BUF; i++) {
+      ring[i] = rand() & 0x3FFF;
+    }
+  }
+
+  BenchExtraction(ring, iterations);
+  BenchText(ring, iterations);
+  if(tracelength < 1 || tracelength > BUF / 2 || pretriggerlength < 0 || pretriggerlength >= tracelength
+     || pt.risetime <= 0 || pt.decaytime <= 0) {
+    std::cout << "Error: Invalid trace or pulse settings" << std::endl;
+  }
+  else {
+    BenchWriters(pt, tracelength, pretriggerlength, rejectmin, rejectmax, filename, iterations);
+  }
+
+  if(iface) {
+    delete iface;
+  }
+  else {
+    free(ring);
+  }
+  return 0;
+}
@@ -0,0 +1,267 @@
+/*
+ * acquisition - RedPitaya Data Acquisition
+ *
+ *
+ * Copyright (C) 2016, 2017 Moritz Kütt, Malte Göttsche, Alexander Glaser
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: moritz@nuclearfreesoftware.org
+ */
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <stdint.h>
+
+#include "TriggeredAcquisition.hh"
+#include "SimulatedFPGAInterface.hh"
+
+void usage() {
+      std::cout << "Usage:" << std::endl;
+      std::cout << "bench_rate [options]" << std::endl;
+      std::cout << std::endl;
+      std::cout << "Runs Measure() against the simulated oscilloscope at a sweep of Poisson" << std::endl;
+      std::cout << "pulse rates, for every selected output method, and reports recorded rate" << std::endl;
+      std::cout << "and dead time fraction against input rate." << std::endl;
+      std::cout << std::endl;
+      std::cout << "Options:" << std::endl;
+      std::cout << "   -r <min> <max> <steps> pulse rates in 1/s, logarithmic steps (default 100 20000 8)" << std::endl;
+      std::cout << "   -s <seconds>           measurement time per point (default 2)" << std::endl;
+      std::cout << "   -o <outputmethod>      output method, may be given several times (default all)" << std::endl;
+      std::cout << "   -m <acqmethod>         acquisition method (default 0)" << std::endl;
+      std::cout << "   -d <decimation>        decimation (default 64, the simulator keeps up)" << std::endl;
+      std::cout << "   -l <tracelength>       trace length (default 384)" << std::endl;
+      std::cout << "   -p <pretriggerlength>  pretrigger length (default 64)" << std::endl;
+      std::cout << "   -v <triggervalue>      trigger level on channel A, negative edge (default -200)" << std::endl;
+      std::cout << "   -f <filename>          output file of the measurements (default /tmp/bench_rate)" << std::endl;
+      std::cout << "   -c <csvfile>           results, with a gnuplot script <csvfile>.gp (default bench_rate.csv)" << std::endl;
+      std::cout << "   -V                     show the output of the measurements" << std::endl;
+}
+
+struct RatePoint {
+  int method;
+  double nominal;     // configured pulse rate
+  double input;       // pulses generated per second
+  double recorded;    // events per second
+  double deadfraction;
+  uint64_t skipped;   // samples the simulator could not generate in time
+};
+
+/** Removes the files a measurement may have written */
+static void RemoveOutput(std::string filename) {
+  const char * suffixes[] = {".bin", ".txt", ".trc", ".ibin", ".spectrum", ".peaks", ".latency.json"};
+  for(int i = 0; i < 7; i++) {
+    remove((filename + suffixes[i]).c_str());
+  }
+}
+
+/** Settings shared by all points of the sweep */
+struct SweepSetup {
+  int acquisition;
+  int decimation;
+  int tracelength;
+  int pretriggerlength;
+  int triggervalue;
+  std::string filename;
+};
+
+/**
+ * One measurement with a fresh simulator and acquisition; the output of
+ * Measure() is hidden unless verbose
+ */
+static bool RunPoint(const SweepSetup & setup, int method, double rate, double seconds, bool verbose, RatePoint & pt) {
+  std::streambuf * coutbuf = std::cout.rdbuf();
+  std::ostringstream discard;
+  if(!verbose) {
+    std::cout.rdbuf(discard.rdbuf());
+  }
+  SimulatedFPGAInterface * sim = new SimulatedFPGAInterface();
+  sim->SetPulseRate(rate);
+  TriggeredAcquisition * ta = new TriggeredAcquisition();
+  ta->SetInterface(sim);
+  ta->SetWriteOff((WriteOffSetting) method);
+  ta->SetAcquisition((AcquisitionSetting) setup.acquisition);
+  ta->SetDecimation(setup.decimation);
+  ta->SetTrigger(TRIG_A_NEG_EDGE);
+  ta->SetTriggervalue(setup.triggervalue);
+  ta->SetTracelength(setup.tracelength);
+  ta->SetPretriggerlength(setup.pretriggerlength);
+  ta->SetFilename(setup.filename);
+  bool ok = ta->Init();
+  if(ok) {
+    ta->Measure(seconds, LENGTH_IS_TIME);
+  }
+  const RunStatistics & rs = ta->GetRunStatistics();
+  pt.method = method;
+  pt.nominal = rate;
+  pt.input = rs.realtime > 0 ? sim->GetGeneratedPulses() / rs.realtime : 0;
+  pt.recorded = rs.realtime > 0 ? rs.events / rs.realtime : 0;
+  pt.deadfraction = rs.realtime > 0 ? 1 - rs.livetime / rs.realtime : 0;
+  pt.skipped = sim->GetSkippedSamples();
+  delete ta;
+  RemoveOutput(setup.filename);
+  std::cout.rdbuf(coutbuf);
+  return ok;
+}
+
+static bool WriteGnuplot(std::string csvfile, const std::vector<int> & methods) {
+  std::string gpfile = csvfile + ".gp";
+  FILE * fh = fopen(gpfile.c_str(), "w");
+  if(!fh) {
+    std::cout << "Error: Could not open " << gpfile << std::endl;
+    return false;
+  }
+  fprintf(fh, "# gnuplot %s\n", gpfile.c_str());
+  fprintf(fh, "set datafile separator \",\"\n");
+  fprintf(fh, "set terminal pngcairo size 1200,500\n");
+  fprintf(fh, "set output \"%s.png\"\n", csvfile.c_str());
+  fprintf(fh, "set multiplot layout 1,2\n");
+  fprintf(fh, "set logscale xy\nset grid\nset key left top\n");
+  fprintf(fh, "set xlabel \"input rate [1/s]\"\nset ylabel \"recorded rate [1/s]\"\n");
+  for(int panel = 0; panel < 2; panel++) {
+    if(panel == 1) {
+      fprintf(fh, "unset logscale y\nset yrange [0:1]\nset ylabel \"dead time fraction\"\n");
+    }
+    fprintf(fh, "plot ");
+    if(panel == 0) {
+      fprintf(fh, "\"%s\" using 3:3 with lines dt 2 lc rgb \"gray\" title \"input\", ", csvfile.c_str());
+    }
+    for(size_t m = 0; m < methods.size(); m++) {
+      fprintf(fh, "%s\"%s\" using 3:($1==%d ? $%d : 1/0) with linespoints title \"-o %d\"", m > 0 ? ", " : "",
+	      csvfile.c_str(), methods[m], panel == 0 ? 4 : 5, methods[m]);
+    }
+    fprintf(fh, "\n");
+  }
+  fprintf(fh, "unset multiplot\n");
+  fclose(fh);
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  double ratemin = 100;
+  double ratemax = 20000;
+  int steps = 8;
+  double seconds = 2;
+  std::vector<int> methods;
+  SweepSetup setup;
+  setup.acquisition = ACQ_DIRECT;
+  setup.decimation = 64;
+  setup.tracelength = 384;
+  setup.pretriggerlength = 64;
+  setup.triggervalue = -200;
+  setup.filename = "/tmp/bench_rate";
+  std::string csvfile = "bench_rate.csv";
+  bool verbose = false;
+
+  for ( int i=1; i<argc; i=i+1 ) {
+    if ( std::string(argv[i]) == "-h" || std::string(argv[i]) == "--help") {
+      usage();
+      return 0;
+    }
+    else if ( std::string(argv[i]) == "-r" && i + 3 < argc ) {
+      ratemin = std::atof(argv[i+1]);
+      ratemax = std::atof(argv[i+2]);
+      steps = std::atoi(argv[i+3]);
+      i += 3;
+    }
+    else if ( std::string(argv[i]) == "-s" ) {
+      i++;
+      seconds = std::atof(argv[i]);
+    }
+    else if ( std::string(argv[i]) == "-o" ) {
+      i++;
+      methods.push_back(std::atoi(argv[i]));
+    }
+    else if ( std::string(argv[i]) == "-m" ) {
+      i++;
+      setup.acquisition = std::atoi(argv[i]);
+    }
+    else if ( std::string(argv[i]) == "-d" ) {
+      i++;
+      setup.decimation = std::atoi(argv[i]);
+    }
+    else if ( std::string(argv[i]) == "-l" ) {
+      i++;
+      setup.tracelength = std::atoi(argv[i]);
+    }
+    else if ( std::string(argv[i]) == "-p" ) {
+      i++;
+      setup.pretriggerlength = std::atoi(argv[i]);
+    }
+    else if ( std::string(argv[i]) == "-v" ) {
+      i++;
+      setup.triggervalue = std::atoi(argv[i]);
+    }
+    else if ( std::string(argv[i]) == "-f" ) {
+      i++;
+      setup.filename = argv[i];
+    }
+    else if ( std::string(argv[i]) == "-c" ) {
+      i++;
+      csvfile = argv[i];
+    }
+    else if ( std::string(argv[i]) == "-V" ) {
+      verbose = true;
+    }
+  }
+  if(ratemin <= 0 || ratemax < ratemin || steps < 1 || seconds <= 0) {
+    std::cout << "Error: Invalid rate sweep" << std::endl;
+    return -1;
+  }
+  if(methods.empty()) {
+    for(int m = WRITE_OFF_ASCII_SINGLE; m <= WRITE_OFF_HISTOGRAM; m++) {
+      methods.push_back(m);
+    }
+  }
+
+  FILE * csv = fopen(csvfile.c_str(), "w");
+  if(!csv) {
+    std::cout << "Error: Could not open " << csvfile << std::endl;
+    return -1;
+  }
+  fprintf(csv, "method,nominal_rate,input_rate,recorded_rate,dead_fraction,efficiency,sim_skipped_samples\n");
+
+  // Warm up (page faults, generator start), the result is not used
+  RatePoint pt;
+  RunPoint(setup, methods[0], ratemin, 0.5, false, pt);
+
+  printf("%6s %12s %12s %12s %10s %10s\n", "method", "nominal/s", "input/s", "recorded/s", "dead", "recorded");
+  for(size_t m = 0; m < methods.size(); m++) {
+    for(int s = 0; s < steps; s++) {
+      double rate = steps > 1 ? ratemin * pow(ratemax / ratemin, (double) s / (steps - 1)) : ratemin;
+
+      if(!RunPoint(setup, methods[m], rate, seconds, verbose, pt)) {
+	std::cout << "Error: Initialization of the simulated oscilloscope failed" << std::endl;
+	fclose(csv);
+	return -1;
+      }
+      printf("%6d %12.0f %12.0f %12.0f %9.1f%% %9.1f%%%s\n", pt.method, pt.nominal, pt.input, pt.recorded,
+	     100 * pt.deadfraction, pt.input > 0 ? 100 * pt.recorded / pt.input : 0, pt.skipped > 0 ? "  (simulator behind)" : "");
+      fflush(stdout);
+      fprintf(csv, "%d,%.1f,%.1f,%.1f,%.5f,%.5f,%llu\n", pt.method, pt.nominal, pt.input, pt.recorded, pt.deadfraction,
+	      pt.input > 0 ? pt.recorded / pt.input : 0, (unsigned long long) pt.skipped);
+    }
+  }
+  fclose(csv);
+  if(WriteGnuplot(csvfile, methods)) {
+    std::cout << "Results written to " << csvfile << ", plot with 'gnuplot " << csvfile << ".gp'" << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,130 @@
+/*
+ * acquisition - RedPitaya Data Acquisition
+ *
+ *
+ * Copyright (C) 2016, 2017 Moritz Kütt, Malte Göttsche, Alexander Glaser
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: moritz@nuclearfreesoftware.org
+ */
+
+#ifndef ASYNCWRITER_H
+#define ASYNCWRITER_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/** Alignment of buffers and of writes with O_DIRECT */
+#define WRITERALIGN 4096
+
+/** Buffering and sync policy of the output file */
+struct WriterSettings {
+  size_t buffersize;      // bytes per buffer, multiple of WRITERALIGN
+  int buffers;            // number of buffers, at least 2
+  bool direct;            // open with O_DIRECT, bypass the page cache
+  uint64_t preallocate;   // bytes reserved with fallocate at open, 0 for none
+  int syncinterval;       // fdatasync after this many buffers, 0 for never
+};
+
+/**
+ * Output file written by a background thread.
+ *
+ * Data is appended to one of a fixed set of page aligned buffers. A full
+ * buffer is handed to the writer thread, which drains it with a single
+ * write() call, so the acquisition loop never waits for the SD card
+ * unless all buffers are full (counted as a stall).
+ *
+ * Only one thread may append (Write, Printf, Reserve / Commit).
+ */
+class AsyncWriter
+{
+public:
+  AsyncWriter();
+  ~AsyncWriter();
+
+  /** Change settings, only while no file is open */
+  void SetSettings(const WriterSettings & s);
+  const WriterSettings & GetSettings() { return settings; }
+
+  bool Open(const std::string & path);
+  /** Write remaining data, wait for the writer thread and close the file */
+  bool Close();
+  bool IsOpen() { return fd >= 0; }
+
+  void Write(const void * data, size_t n);
+  void Printf(const char * format, ...);
+
+  /**
+   * Space for n bytes to be filled in place, followed by Commit() with
+   * the number of bytes actually used (at most n).
+   */
+  char * Reserve(size_t n);
+  void Commit(size_t n);
+
+  /** Touch every page of the output buffers, after Open() */
+  void Prefault();
+
+  uint64_t GetBytesWritten() { return byteswritten; }
+  uint64_t GetBuffersWritten() { return flushes; }
+  uint64_t GetStalls() { return stalls; }
+  double GetStallTime() { return stalltime * 1e-9; }
+  double GetMeanFlushLatency() { return flushes > 0 ? flushtime * 1e-9 / flushes : 0; }
+  double GetMaxFlushLatency() { return flushmax * 1e-9; }
+  void DumpStatistics();
+
+private:
+  void Run();
+  void Submit();
+  bool WriteBuffer(const char * buf, size_t n);
+  void FreeBuffers();
+
+  WriterSettings settings;
+  int fd;
+  std::string path;
+  bool failed;
+
+  std::vector<char *> buffers;
+  std::vector<size_t> fills;
+  std::deque<int> fullbuffers;
+  std::deque<int> freebuffers;
+  int cur;
+  size_t curfill;
+  uint64_t logicalsize;
+
+  char * spill;
+  size_t spillsize;
+  bool spilled;
+
+  std::thread writer;
+  std::mutex mtx;
+  std::condition_variable cvfull;
+  std::condition_variable cvfree;
+  bool stopping;
+
+  uint64_t byteswritten;
+  uint64_t flushes;
+  uint64_t flushtime;
+  uint64_t flushmax;
+  uint64_t stalls;
+  uint64_t stalltime;
+};
+
+#endif /* ASYNCWRITER_H */
@@ -0,0 +1,84 @@
+/*
+ * acquisition - RedPitaya Data Acquisition
+ *
+ *
+ * Copyright (C) 2016, 2017 Moritz Kütt, Malte Göttsche, Alexander Glaser
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: moritz@nuclearfreesoftware.org
+ */
+
+#ifndef BURSTBUFFER_H
+#define BURSTBUFFER_H
+
+#include <stdint.h>
+#include <cstddef>
+
+#include "EventRing.hh"
+
+/**
+ * Fixed memory budget for burst capture.
+ *
+ * The memory is reserved once with mmap (optionally on huge pages),
+ * touched and locked, so no page fault or allocation happens while
+ * events are captured. Traces are stored as extracted (signed 16-bit,
+ * slots on cache line boundaries), event timing in a separate array.
+ */
+class BurstBuffer
+{
+public:
+  BurstBuffer();
+  virtual ~BurstBuffer();
+
+  /** Reserve and lock bytes of memory, returns false if not possible */
+  bool Allocate(size_t bytes, bool hugepages);
+  void Free();
+  bool IsValid() { return mem != NULL; }
+  bool IsLocked() { return locked; }
+  bool HasHugePages() { return huge; }
+  size_t GetBytes() { return bytes; }
+
+  /** Split the budget into slots of n samples, drops stored events */
+  void Prepare(int samples);
+  int GetCapacity() { return capacity; }
+  int GetCount() { return count; }
+  bool IsFull() { return count >= capacity; }
+
+  /** Slot for the next event, valid until Push(), NULL if full */
+  inline int16_t * Next() {
+    return count < capacity ? traces + (size_t) count * slotsamples : NULL;
+  }
+  inline void Push(const EventTiming & timing) {
+    times[count] = timing;
+    count++;
+  }
+
+  int16_t * GetTrace(int i) { return traces + (size_t) i * slotsamples; }
+  const EventTiming & GetTiming(int i) { return times[i]; }
+
+private:
+  char * mem;
+  size_t bytes;
+  bool huge;
+  bool locked;
+
+  EventTiming * times;
+  int16_t * traces;
+  int slotsamples;
+  int capacity;
+  int count;
+};
+
+#endif /* BURSTBUFFER_H */
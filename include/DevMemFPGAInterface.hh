@@ -0,0 +1,46 @@
+/*
+ * acquisition - RedPitaya Data Acquisition
+ *
+ *
+ * Copyright (C) 2016, 2017 Moritz Kütt, Malte Göttsche, Alexander Glaser
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: moritz@nuclearfreesoftware.org
+ */
+
+#ifndef DEVMEMFPGAINTERFACE_H
+#define DEVMEMFPGAINTERFACE_H
+
+#include "FPGAInterface.hh"
+
+/**
+ * Oscilloscope module of the Red Pitaya FPGA, accessed through /dev/mem.
+ */
+class DevMemFPGAInterface : public FPGAInterface
+{
+public:
+  DevMemFPGAInterface();
+  virtual ~DevMemFPGAInterface();
+
+  int initOscilloscope();
+  int stopOscilloscope();
+
+private:
+  int omem_fd;
+  void * fpgaptr;
+};
+
+
+#endif /* DEVMEMFPGAINTERFACE_H */
@@ -0,0 +1,99 @@
+/*
+ * acquisition - RedPitaya Data Acquisition
+ *
+ *
+ * Copyright (C) 2016, 2017 Moritz Kütt, Malte Göttsche, Alexander Glaser
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: moritz@nuclearfreesoftware.org
+ */
+
+#ifndef EVENTRING_H
+#define EVENTRING_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <atomic>
+
+/** Timing of one event, in ns since the start of the run */
+struct EventTiming {
+  uint64_t armtime;       // trigger was armed
+  uint64_t observedtime;  // trigger was seen by the polling loop
+  uint64_t triggertime;   // trigger sample, from the FPGA write and trigger pointers
+};
+
+/** One captured event in the ring */
+struct EventSlot {
+  int16_t * samples;
+  EventTiming timing;
+};
+
+/**
+ * Preallocated single-producer / single-consumer ring of event slots.
+ *
+ * The producer fills the slot returned by Claim() and hands it over with
+ * Publish(), the consumer processes the slot returned by Peek() and gives
+ * it back with Release(). No locks and no allocation after construction;
+ * the number of slots is rounded up to a power of two.
+ */
+class EventRing
+{
+public:
+  EventRing(int slots, int samples);
+  virtual ~EventRing();
+
+  bool IsValid() { return samples != NULL; }
+  int GetSize() { return size; }
+  int GetSamplesPerSlot() { return slotsamples; }
+  int GetFill() { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+
+  // Producer side
+  inline EventSlot * Claim() {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    if(h - tail.load(std::memory_order_acquire) >= (uint32_t) size) {
+      return NULL;
+    }
+    return &slots[h & mask];
+  }
+  inline void Publish() {
+    head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  // Consumer side
+  inline EventSlot * Peek() {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    if(t == head.load(std::memory_order_acquire)) {
+      return NULL;
+    }
+    return &slots[t & mask];
+  }
+  inline void Release() {
+    tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+private:
+  int size;
+  uint32_t mask;
+  int slotsamples;
+  EventSlot * slots;
+  int16_t * samples;
+
+  // Producer and consumer index on separate cache lines
+  alignas(64) std::atomic<uint32_t> head;
+  alignas(64) std::atomic<uint32_t> tail;
+};
+
+
+#endif /* EVENTRING_H */
@@ -24,6 +24,7 @@
 #define FPGAINTERFACE_H
 
 #include <stdint.h>
+#include <string>
 
 #define OSCBASE         0x40100000
 #define OSCBASESIZE     0x30000
@@ -31,6 +32,7 @@
 #define OSCCHBOFFSET    0x20000
 
 #define ADCBITS 14
+#define ADCSAMPLERATE 125000000
 
 #define TRIGGERARMBIT   1
 #define OSCRESETBIT     2
@@ -72,6 +74,17 @@ struct oscilloscope_mem {
   uint32_t filter_pp_B;
 };
 
+/**
+ * Backend independent access to the oscilloscope module.
+ *
+ * Implementations map the register block and the channel buffers in
+ * initOscilloscope(); the accessors below only return the stored
+ * pointers, so the acquisition hot path never goes through a virtual
+ * call.
+ *
+ * If the bitstream raises an interrupt on the trigger, it can be waited
+ * for through its UIO device (e.g. /dev/uio0, see OpenInterrupt()).
+ */
 class FPGAInterface
 {
 public:
@@ -82,20 +95,52 @@ public:
   int stopHousekeeping();
   housekeeping_mem * GetHousekeepingMemory() {return hmem; };
   
-  int initOscilloscope();
-  int stopOscilloscope();
-  oscilloscope_mem * GetOscilloscopeMemory();
+  virtual int initOscilloscope() = 0;
+  virtual int stopOscilloscope() = 0;
+  volatile oscilloscope_mem * GetOscilloscopeMemory();
   uint32_t * GetOscilloscopeChannelA();
   uint32_t * GetOscilloscopeChannelB();
 
-private:
+  /**
+   * Set or clear bits of the configuration register. The simulated
+   * oscilloscope changes the register from its generator thread, so
+   * there the update is an atomic read-modify-write; on the FPGA (device
+   * memory, no exclusive access) it is a plain one.
+   */
+  void SetConfigurationBits(uint32_t bits) {
+    if(atomicconfig) {
+      __atomic_fetch_or(&omem->configuration, bits, __ATOMIC_SEQ_CST);
+    }
+    else {
+      omem->configuration |= bits;
+    }
+  }
+  void ClearConfigurationBits(uint32_t bits) {
+    if(atomicconfig) {
+      __atomic_fetch_and(&omem->configuration, ~bits, __ATOMIC_SEQ_CST);
+    }
+    else {
+      omem->configuration &= ~bits;
+    }
+  }
+
+  bool OpenInterrupt(std::string device);
+  void CloseInterrupt();
+  bool HasInterrupt() { return irq_fd >= 0; }
+  /** Unmask the interrupt, returns false on error */
+  bool EnableInterrupt();
+  /** Wait for the interrupt, 1 if it fired, 0 at the timeout, -1 on error */
+  int WaitInterrupt(int timeoutms);
+
+protected:
   bool hinit;
   housekeeping_mem * hmem;
   bool oinit;
-  oscilloscope_mem * omem;
-  int omem_fd;
+  volatile oscilloscope_mem * omem;
   uint32_t *ochA;
   uint32_t *ochB;
+  bool atomicconfig;
+  int irq_fd;
   
 };
 
@@ -0,0 +1,80 @@
+/*
+ * acquisition - RedPitaya Data Acquisition
+ *
+ *
+ * Copyright (C) 2016, 2017 Moritz Kütt, Malte Göttsche, Alexander Glaser
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: moritz@nuclearfreesoftware.org
+ */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <string>
+
+/**
+ * Fixed binning histogram for on-device spectra.
+ *
+ * Fill() is cheap enough for the event loop; Save() writes a text file
+ * atomically (temporary file + rename), so a reader never sees a partial
+ * spectrum.
+ */
+class Histogram
+{
+public:
+  Histogram(int nbins = 1024, double min = 0, double max = 131072);
+  virtual ~Histogram();
+
+  void SetBinning(int nbins, double min, double max);
+  void Reset();
+  void CopyFrom(const Histogram & h);
+  bool Add(const Histogram & h);
+  bool Save(std::string file, std::string title, double realtime, double livetime);
+
+  inline void Fill(double v) {
+    double x = (v - min) * scale;
+    if(x < 0) {
+      underflow++;
+    }
+    else if(x >= bins) {
+      overflow++;
+    }
+    else {
+      counts[(int) x]++;
+    }
+    entries++;
+  }
+
+  int GetBins() { return bins; }
+  double GetMin() { return min; }
+  double GetMax() { return max; }
+  uint64_t GetEntries() { return entries; }
+  uint32_t * GetCounts() { return counts; }
+
+private:
+  int bins;
+  double min;
+  double max;
+  double scale;
+  uint32_t * counts;
+  uint64_t entries;
+  uint64_t underflow;
+  uint64_t overflow;
+};
+
+
+#endif /* HISTOGRAM_H */
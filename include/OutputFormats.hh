@@ -0,0 +1,141 @@
+/*
+ * acquisition - RedPitaya Data Acquisition
+ *
+ *
+ * Copyright (C) 2016, 2017 Moritz Kütt, Malte Göttsche, Alexander Glaser
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: moritz@nuclearfreesoftware.org
+ */
+
+#ifndef OUTPUTFORMATS_H
+#define OUTPUTFORMATS_H
+
+#include <stdint.h>
+
+/**
+ * Summary of a run, written at the end of binary integral and compact
+ * trace files. The header of these files gives its size (footersize),
+ * so the records / blocks end footersize bytes before the end of file.
+ */
+
+#define RUNFOOTERMAGIC      "IBXRUN"
+
+struct RunFooter {
+  char magic[8];
+  uint64_t events;      // events written (including rejected ones), triggers if both channels are recorded
+  uint64_t rejected;    // events that failed the rejection (on at least one channel)
+  double realtime;      // s, from the start to the end of the measurement
+  double livetime;      // s, the acquisition was ready for a trigger
+  double deadfraction;  // 1 - livetime / realtime
+};
+
+/** recorded channels (channels field of the headers) */
+#define CHANNELS_A          0
+#define CHANNELS_B          1
+#define CHANNELS_BOTH       2   // A and B trace of every event, A first
+
+/**
+ * Binary integral file (WRITE_OFF_BINARY_INTEGRAL)
+ *
+ * An IntegralFileHeader followed by IntegralRecords, one per event and
+ * channel (accepted and rejected), and a RunFooter, in host byte order.
+ * headersize and recordsize allow readers to skip fields added in later
+ * versions. Version 1 had no arm / observed times and no footer, version
+ * 2 no channels.
+ */
+
+#define INTEGRALFILEMAGIC   "IBXINTG"
+#define INTEGRALFILEVERSION 3
+
+struct IntegralFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t headersize;
+  uint32_t recordsize;
+  int32_t decimation;
+  int32_t tracelength;
+  int32_t pretriggerlength;
+  int32_t triggervalue;
+  int32_t trigger;
+  float triggervoltage;
+  float ratiomin;
+  float ratiomax;
+  int32_t channelstart;
+  int32_t channelend;
+  float curvebend;
+  int32_t baselinelength;
+  uint32_t footersize;
+  int32_t channels;
+};
+
+/** flags of an IntegralRecord */
+#define INTEGRAL_REJECTED   1
+#define INTEGRAL_CHANNEL_B  2   // integral of the channel B trace
+
+struct IntegralRecord {
+  double integral;        // baseline subtracted integral
+  uint64_t timestamp;     // ns since start of the run, trigger sample time
+  int32_t peak;           // baseline subtracted peak
+  int32_t baseline;       // sum over the baseline samples
+  int32_t peakpos;        // position of the peak in the trace
+  uint32_t flags;
+  uint64_t armtime;       // ns since start of the run, trigger armed
+  uint64_t observedtime;  // ns since start of the run, trigger seen by the program
+};
+
+/**
+ * Compact trace file (WRITE_OFF_BINARY_TRACE)
+ *
+ * A TraceFileHeader followed by blocks. Each block is a TraceBlockHeader
+ * and <bytes> of payload holding <traces> traces with <samples> samples
+ * in total. Within a trace, every sample is stored as the difference to
+ * the previous one (the first to 0), zig-zag mapped to an unsigned value
+ * and written as little endian base-128 varint (see TraceCodec.hh).
+ * With both channels recorded, the A and B trace of an event follow each
+ * other (channels, version 3 and later).
+ * The file ends with a RunFooter (version 2 and later).
+ */
+
+#define TRACEFILEMAGIC      "IBXTRCE"
+#define TRACEFILEVERSION    3
+#define TRACEBLOCKMAGIC     0x4b4c4254  // "TBLK"
+
+/** encoding of a trace file */
+#define TRACE_ENCODING_DELTA_VARINT 1
+
+struct TraceFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t headersize;
+  uint32_t encoding;
+  int32_t decimation;
+  int32_t tracelength;
+  int32_t pretriggerlength;
+  int32_t triggervalue;
+  int32_t trigger;
+  float triggervoltage;
+  uint32_t footersize;
+  int32_t channels;
+};
+
+struct TraceBlockHeader {
+  uint32_t magic;
+  uint32_t bytes;
+  uint32_t traces;
+  uint32_t samples;
+};
+
+#endif /* OUTPUTFORMATS_H */
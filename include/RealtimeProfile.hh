@@ -0,0 +1,127 @@
+/*
+ * acquisition - RedPitaya Data Acquisition
+ *
+ *
+ * Copyright (C) 2016, 2017 Moritz Kütt, Malte Göttsche, Alexander Glaser
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: moritz@nuclearfreesoftware.org
+ */
+
+#ifndef REALTIMEPROFILE_H
+#define REALTIMEPROFILE_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+#include <time.h>
+#include <sched.h>
+
+struct RealtimeSettings {
+  bool enabled;
+  int core;             // core of the acquisition loop, -1 to keep the affinity
+  int priority;         // SCHED_FIFO priority (1 to 99), 0 to keep the scheduler
+};
+
+#define JITTERBUCKETS 40
+/** Stack touched by Enter(), the loop takes no faults on its stack */
+#define STACKPREFAULT (256 * 1024)
+
+/**
+ * Real-time profile of the acquisition loop.
+ *
+ * Prepare() locks all present and future memory of the process
+ * (mlockall), Prefault() touches every page of a buffer without
+ * changing it, so page faults happen before the first arm and not
+ * during the measurement. Enter() pins the calling thread to a core and
+ * raises it to SCHED_FIFO, Leave() restores both. What cannot be done
+ * (no privileges, no such core) is reported and skipped, the run goes on.
+ *
+ * The jitter histogram holds the time from Mark() to Record() of every
+ * loop iteration in powers of two (bucket b counts [2^b, 2^(b+1)) ns),
+ * like StageProfiler. Only the thread running the loop may record.
+ */
+class RealtimeProfile
+{
+public:
+  RealtimeProfile();
+  virtual ~RealtimeProfile();
+
+  void SetSettings(const RealtimeSettings & rs);
+  const RealtimeSettings & GetSettings() { return settings; }
+  bool IsEnabled() { return settings.enabled; }
+
+  /** Lock the memory of the process and reset the jitter histogram */
+  void Prepare();
+  /** Stop locking new mappings, pages locked so far stay locked */
+  void Finish();
+  static void Prefault(void * mem, size_t bytes);
+
+  /** Pin the calling thread and raise its priority */
+  void Enter();
+  /** Restore affinity and scheduler, in the thread that called Enter() */
+  void Leave();
+
+  static inline uint64_t Now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  }
+
+  /** Start of a loop iteration */
+  inline void Mark() {
+    last = Now();
+  }
+
+  /** End of a loop iteration */
+  inline void Record() {
+    uint64_t ns = Now() - last;
+    int b = ns > 0 ? 63 - __builtin_clzll(ns) : 0;
+    if(b >= JITTERBUCKETS) {
+      b = JITTERBUCKETS - 1;
+    }
+    buckets[b]++;
+    count++;
+    sum += ns;
+    if(ns > maximum) {
+      maximum = ns;
+    }
+  }
+
+  uint64_t GetCount() { return count; }
+  uint64_t GetMax() { return maximum; }
+  double GetMean() { return count > 0 ? (double) sum / count : 0; }
+  uint64_t GetQuantile(double q);
+  void Print();
+  bool Save(std::string file);
+
+private:
+  RealtimeSettings settings;
+  bool locked;
+  bool pinned;
+  bool raised;
+  cpu_set_t oldset;
+  int oldpolicy;
+  struct sched_param oldparam;
+
+  uint64_t last;
+  uint64_t count;
+  uint64_t sum;
+  uint64_t maximum;
+  uint64_t buckets[JITTERBUCKETS];
+};
+
+
+#endif /* REALTIMEPROFILE_H */
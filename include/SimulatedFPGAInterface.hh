@@ -0,0 +1,140 @@
+/*
+ * acquisition - RedPitaya Data Acquisition
+ *
+ *
+ * Copyright (C) 2016, 2017 Moritz Kütt, Malte Göttsche, Alexander Glaser
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: moritz@nuclearfreesoftware.org
+ */
+
+#ifndef SIMULATEDFPGAINTERFACE_H
+#define SIMULATEDFPGAINTERFACE_H
+
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <atomic>
+
+#include "FPGAInterface.hh"
+
+#define SIMBUF         (16*1024)
+#define SIMMAXPULSES   256
+#define SIMNOISEBITS   16
+
+/** Parameters of the simulated detector signal */
+struct SimulationSettings {
+  double samplerate;       // ADC sampling rate in samples/s (before decimation)
+  double pulserate;        // mean pulse rate in 1/s (Poisson distributed)
+  int amplitude;           // mean pulse height in ADC channels
+  double amplitudespread;  // relative gaussian spread of pulse height
+  double risetime;         // rise time constant in ns
+  double decaytime;        // decay time constant in ns
+  double noise;            // rms noise in ADC channels
+  int baseline;            // baseline in ADC channels
+  int polarity;            // +1 for positive, -1 for negative pulses
+  uint32_t seed;           // seed of the random generator
+};
+
+/**
+ * Software model of the oscilloscope module.
+ *
+ * The register block and the channel A / B ring buffers live in anonymous
+ * memory or in an mmap'd file with the same layout as the FPGA memory
+ * window. A generator thread produces a Poisson distributed pulse train
+ * in (simulated) real time and follows the register protocol of the FPGA:
+ * while TRIGGERARMBIT is set, samples are written at writepointer; a
+ * trigger stores triggerpointer, and after posttriggertracelength more
+ * samples the trigger register is cleared and writing stops until the
+ * next arm. As on the FPGA, the edge comparator starts from the signal
+ * level at the arm.
+ */
+class SimulatedFPGAInterface : public FPGAInterface
+{
+public:
+  SimulatedFPGAInterface(std::string file = "");
+  virtual ~SimulatedFPGAInterface();
+
+  int initOscilloscope();
+  int stopOscilloscope();
+
+  SimulationSettings & GetSettings() { return settings; }
+  void SetPulseRate(double rate) { settings.pulserate = rate; }
+  void SetAmplitude(int amp) { settings.amplitude = amp; }
+  void SetPolarity(int pol) { settings.polarity = (pol < 0) ? -1 : 1; }
+
+  uint64_t GetGeneratedPulses() { return generated; }
+  uint64_t GetCapturedPulses() { return captured; }
+  uint64_t GetTriggers() { return triggers; }
+  uint64_t GetSkippedSamples() { return skipped; }
+  void DumpStatistics();
+
+private:
+  struct Pulse {
+    int64_t start;
+    double amplitude;
+  };
+  struct PulseChannel {
+    double nextarrival;
+    Pulse pulses[SIMMAXPULSES];
+    int first;
+    int count;
+  };
+
+  void Run();
+  void Generate(int64_t n, bool armed);
+  void FinishCapture(uint32_t wp);
+  void ExpirePulses(PulseChannel & ch, int64_t t);
+  int SampleValue(PulseChannel & ch, int64_t t, bool armed);
+  void SchedulePulses(PulseChannel & ch, int64_t t, bool armed);
+  void BuildTemplate(int decimation);
+  double Uniform();
+  double Gauss();
+
+  std::string filename;
+  int fd;
+  void * memory;
+
+  SimulationSettings settings;
+  float * pulsetemplate;
+  int templatelength;
+  int templatedecimation;
+  double samplesperpulse;
+
+  PulseChannel channelA;
+  PulseChannel channelB;
+  int64_t samplecount;
+  bool triggered;
+  bool wasarmed;
+  uint32_t postcount;
+  int lastA;
+  int lastB;
+  uint32_t rng;
+  float noisetable[1 << SIMNOISEBITS];
+  int noisevalue[2 * SIMBUF];
+  uint32_t noiseblock[2 * SIMBUF];
+  int noisemax;
+
+  std::thread generator;
+  std::atomic<bool> running;
+
+  std::atomic<uint64_t> generated;
+  std::atomic<uint64_t> captured;
+  std::atomic<uint64_t> triggers;
+  uint64_t skipped;
+};
+
+
+#endif /* SIMULATEDFPGAINTERFACE_H */
@@ -0,0 +1,122 @@
+/*
+ * acquisition - RedPitaya Data Acquisition
+ *
+ *
+ * Copyright (C) 2016, 2017 Moritz Kütt, Malte Göttsche, Alexander Glaser
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: moritz@nuclearfreesoftware.org
+ */
+
+#ifndef STAGEPROFILER_H
+#define STAGEPROFILER_H
+
+#include <stdint.h>
+#include <string>
+#include <time.h>
+
+/**
+ * Latency histograms for the stages of the acquisition hot path.
+ *
+ * The probes are only compiled in with the build option ENABLE_PROFILING
+ * (defines IBX_PROFILING); otherwise PROFILE_MARK / PROFILE_STAGE expand
+ * to nothing. Each probe reads CLOCK_MONOTONIC (vDSO, no system call) and
+ * charges the time since the previous probe to a stage, so one clock read
+ * per stage is all the overhead. Durations are binned in powers of two
+ * (bucket b counts [2^b, 2^(b+1)) ns), with count, sum and maximum per
+ * stage. A StageProfiler is not thread safe, every thread needs its own
+ * (see Merge()).
+ */
+
+enum ProfileStage {
+  STAGE_ARM = 0,        // arming the trigger
+  STAGE_WAIT = 1,       // armed until the trigger is seen
+  STAGE_SEARCH = 2,     // software trigger over streamed / captured samples
+  STAGE_COPY = 3,       // trace copy out of the FPGA memory
+  STAGE_INTEGRATE = 4,  // baseline, integral and peak
+  STAGE_REJECT = 5,     // rejection conditions
+  STAGE_FORMAT = 6,     // conversion / encoding / histogram fill
+  STAGE_WRITE = 7,      // hand over to the writer, including stalls
+  STAGE_COUNT = 8
+};
+
+#define PROFILEBUCKETS 40
+
+class StageProfiler
+{
+public:
+  StageProfiler();
+  virtual ~StageProfiler();
+
+  void Reset();
+  void Merge(const StageProfiler & p);
+  void Print();
+  bool SaveJSON(std::string file, std::string run);
+
+  static inline uint64_t Now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  }
+
+  /** Start of a sequence of stages */
+  inline void Mark() {
+    last = Now();
+  }
+
+  /** Charge the time since the last probe to stage */
+  inline void Record(int stage) {
+    uint64_t now = Now();
+    Add(stage, now - last);
+    last = now;
+  }
+
+  inline void Add(int stage, uint64_t ns) {
+    int b = ns > 0 ? 63 - __builtin_clzll(ns) : 0;
+    if(b >= PROFILEBUCKETS) {
+      b = PROFILEBUCKETS - 1;
+    }
+    buckets[stage][b]++;
+    counts[stage]++;
+    sums[stage] += ns;
+    if(ns > maxima[stage]) {
+      maxima[stage] = ns;
+    }
+  }
+
+  uint64_t GetCount(int stage) { return counts[stage]; }
+  uint64_t GetMax(int stage) { return maxima[stage]; }
+  double GetMean(int stage) { return counts[stage] > 0 ? (double) sums[stage] / counts[stage] : 0; }
+  uint64_t GetQuantile(int stage, double q);
+  static const char * StageName(int stage);
+
+private:
+  uint64_t last;
+  uint64_t counts[STAGE_COUNT];
+  uint64_t sums[STAGE_COUNT];
+  uint64_t maxima[STAGE_COUNT];
+  uint64_t buckets[STAGE_COUNT][PROFILEBUCKETS];
+};
+
+#ifdef IBX_PROFILING
+#define PROFILE_MARK(p) (p).Mark()
+#define PROFILE_STAGE(p, stage) (p).Record(stage)
+#else
+#define PROFILE_MARK(p) do {} while(0)
+#define PROFILE_STAGE(p, stage) do {} while(0)
+#endif
+
+
+#endif /* STAGEPROFILER_H */
@@ -0,0 +1,53 @@
+/*
+ * acquisition - RedPitaya Data Acquisition
+ *
+ *
+ * Copyright (C) 2016, 2017 Moritz Kütt, Malte Göttsche, Alexander Glaser
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: moritz@nuclearfreesoftware.org
+ */
+
+#ifndef TEXTFORMAT_H
+#define TEXTFORMAT_H
+
+#include <stdint.h>
+
+/** Largest text size of one trace sample ("%d " of a raw 14-bit value) */
+const int MAXTEXTSAMPLE = 6;
+/** Largest text size of one FormatFixed() value */
+const int MAXTEXTFIXED = 48;
+
+/**
+ * Write v like printf("%d") to p, returns the position after the last
+ * character. No terminating zero is written.
+ */
+char * FormatInt(char * p, int v);
+
+/**
+ * Write v like printf("%f") to p, returns the position after the last
+ * character. Values that can not be rounded safely in fixed point (large,
+ * not finite or close to a rounding tie) are passed to snprintf.
+ */
+char * FormatFixed(char * p, double v);
+
+/**
+ * Render a trace as one text line, "%d " per raw sample and a newline,
+ * like the ASCII output mode. out needs n * MAXTEXTSAMPLE + 1 bytes.
+ * Returns the number of bytes written.
+ */
+int FormatTrace(const int16_t * trace, int n, char * out);
+
+#endif /* TEXTFORMAT_H */
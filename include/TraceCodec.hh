@@ -0,0 +1,45 @@
+/*
+ * acquisition - RedPitaya Data Acquisition
+ *
+ *
+ * Copyright (C) 2016, 2017 Moritz Kütt, Malte Göttsche, Alexander Glaser
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: moritz@nuclearfreesoftware.org
+ */
+
+#ifndef TRACECODEC_H
+#define TRACECODEC_H
+
+#include <stdint.h>
+
+/** Largest encoded size of one sample (15 bit zig-zag delta) */
+const int MAXENCODEDSAMPLE = 3;
+
+/**
+ * Delta + zig-zag + varint coding of signed 14-bit traces.
+ *
+ * Consecutive ADC samples differ little, so most samples take one byte
+ * instead of four. EncodeTrace() needs at most n * MAXENCODEDSAMPLE bytes.
+ */
+int EncodeTrace(const int16_t * trace, int n, uint8_t * out);
+
+/**
+ * Decode n samples from in (at most avail bytes). Returns the number of
+ * bytes consumed, or -1 if the data is truncated or corrupt.
+ */
+int DecodeTrace(const uint8_t * in, int avail, int n, int16_t * out);
+
+#endif /* TRACECODEC_H */
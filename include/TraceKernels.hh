@@ -0,0 +1,95 @@
+/*
+ * acquisition - RedPitaya Data Acquisition
+ *
+ *
+ * Copyright (C) 2016, 2017 Moritz Kütt, Malte Göttsche, Alexander Glaser
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: moritz@nuclearfreesoftware.org
+ */
+
+#ifndef TRACEKERNELS_H
+#define TRACEKERNELS_H
+
+#include <stdint.h>
+
+#include "FPGAInterface.hh"
+
+/** Number of samples at the beginning of a trace used as baseline */
+const int BASELINELENGTH = 25;
+
+/** Integer results of one pass over a trace */
+struct TraceIntegral {
+  int32_t baseline;   // sum of the first baselinelength samples
+  int32_t total;      // sum of all samples
+  int32_t peak;       // largest absolute value in the peak window
+  int32_t peakpos;    // first position of peak in the trace (0 if peak is 0)
+};
+
+/**
+ * Copy n samples starting at start out of a ring buffer of raw 14-bit
+ * two's complement ADC samples (e.g. the FPGA channel memory) into dest
+ * as signed 16-bit values. The wrap-around is split into at most two
+ * contiguous spans, each read with wide loads.
+ */
+void ExtractTrace(const uint32_t * ring, int ringsize, int start, int n, int16_t * dest);
+void ExtractSpan(const uint32_t * src, int n, int16_t * dest);
+void ExtractSpanScalar(const uint32_t * src, int n, int16_t * dest);
+
+/**
+ * Integrate a trace of signed samples. The peak is searched in
+ * [peakstart, peakend] (inclusive, clipped to the trace). IntegrateTrace()
+ * uses NEON or SSE2 where available and returns exactly the same result
+ * as the scalar reference IntegrateTraceScalar().
+ */
+void IntegrateTrace(const int16_t * trace, int n, int baselinelength,
+		    int peakstart, int peakend, TraceIntegral & res);
+void IntegrateTraceScalar(const int16_t * trace, int n, int baselinelength,
+			  int peakstart, int peakend, TraceIntegral & res);
+
+/**
+ * Baseline subtracted integral and peak of a trace of n samples from
+ * the result of IntegrateTrace(), and the rejection test of acquisition
+ * -r / -s on them (true if the pulse is accepted). Shared by the
+ * acquisition and the offline tools, so both decide alike.
+ */
+void SubtractBaseline(const TraceIntegral & ti, int n, int baselinelength, double & total, int & peak);
+bool AcceptPulse(double total, int peak, float ratiomin, float ratiomax, float curvebend);
+
+/**
+ * Leading edge discriminator over raw ADC samples. Returns the index of
+ * the first sample in src[0, n) that is beyond threshold (>= for rising,
+ * <= for falling edges) while the sample before was not, or -1. beyond
+ * holds the state of the last sample seen and is carried from one call
+ * to the next. FindCrossing() skips blocks without a crossing with wide
+ * compares and returns the same index as FindCrossingScalar().
+ */
+int FindCrossing(const uint32_t * src, int n, int threshold, bool rising, bool & beyond);
+int FindCrossingScalar(const uint32_t * src, int n, int threshold, bool rising, bool & beyond);
+/** Same on extracted (signed 16-bit) samples */
+int FindCrossing(const int16_t * src, int n, int threshold, bool rising, bool & beyond);
+int FindCrossingScalar(const int16_t * src, int n, int threshold, bool rising, bool & beyond);
+
+/** Convert a raw 14-bit two's complement sample to a signed value */
+inline int32_t SignedSample(uint32_t raw) {
+  return ((int32_t) (raw << (32 - ADCBITS))) >> (32 - ADCBITS);
+}
+
+/** Convert a signed sample back to the raw FPGA representation */
+inline uint32_t RawSample(int32_t signal) {
+  return (uint32_t) signal & ((1 << ADCBITS) - 1);
+}
+
+#endif /* TRACEKERNELS_H */
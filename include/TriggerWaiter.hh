@@ -0,0 +1,109 @@
+/*
+ * acquisition - RedPitaya Data Acquisition
+ *
+ *
+ * Copyright (C) 2016, 2017 Moritz Kütt, Malte Göttsche, Alexander Glaser
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: moritz@nuclearfreesoftware.org
+ */
+
+#ifndef TRIGGERWAITER_H
+#define TRIGGERWAITER_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "FPGAInterface.hh"
+
+/** How the trigger register is waited for */
+enum WaitStrategy {
+  WAIT_SPIN = 0,       // poll continuously, lowest latency, one core busy
+  WAIT_YIELD = 1,      // poll, then sched_yield() between polls
+  WAIT_SLEEP = 2,      // poll, then nanosleep() with exponential backoff
+  WAIT_INTERRUPT = 3   // poll, then block on the UIO interrupt (sleep if there is none)
+};
+
+struct WaitSettings {
+  WaitStrategy strategy;
+  int spinpolls;        // polls before yielding / sleeping
+  int minsleep;         // ns, first sleep of WAIT_SLEEP
+  int maxsleep;         // ns, longest sleep of WAIT_SLEEP
+  double timeout;       // s without trigger until Wait() gives up, 0 for never
+};
+
+/** Polls between clock reads while spinning, for the timeout */
+#define WAITCHECKPOLLS 4096
+
+/**
+ * Waits until the FPGA clears the trigger register (trigger seen).
+ *
+ * Every wait starts with spinpolls polls without a clock read, so at
+ * high rates the strategies behave alike. Only waits that get past the
+ * spin phase read the clock, once per round (WAITCHECKPOLLS polls while
+ * spinning, one yield, sleep or interrupt wait otherwise), for the
+ * timeout and the statistics: the time between the last round that saw
+ * no trigger and the one that did is an upper bound of the wake-up
+ * latency, and the thread CPU time spent in these waits is compared to
+ * the time waited. Not thread safe, one TriggerWaiter per waiting thread.
+ */
+class TriggerWaiter
+{
+public:
+  TriggerWaiter();
+  virtual ~TriggerWaiter();
+
+  void SetSettings(const WaitSettings & ws);
+  const WaitSettings & GetSettings() { return settings; }
+
+  /** Reset the statistics, select the interrupt of fi (if used and available) */
+  void Prepare(FPGAInterface * fi);
+  /** Wait for the trigger, false at the timeout */
+  bool Wait(volatile oscilloscope_mem * mem);
+  void Print();
+
+  static const char * StrategyName(WaitStrategy ws);
+
+  uint64_t GetWaits() { return waits; }
+  uint64_t GetTimeouts() { return timeouts; }
+  double GetWaitedTime() { return waitedns * 1e-9; }      // s, after the spin phase
+  double GetCPUTime() { return cpuns * 1e-9; }            // s, after the spin phase
+  double GetMeanLatency() { return slowwakes > 0 ? (double) latencysum / slowwakes : 0; }  // ns
+  uint64_t GetMaxLatency() { return latencymax; }         // ns
+
+private:
+  static inline uint64_t Now(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  }
+  bool Round(volatile oscilloscope_mem * mem, uint64_t & sleep, uint64_t remaining);
+
+  WaitSettings settings;
+  WaitStrategy strategy;  // in use, WAIT_SLEEP if there is no interrupt
+  FPGAInterface * iface;
+
+  uint64_t waits;
+  uint64_t spinwakes;     // trigger seen within the spin phase
+  uint64_t slowwakes;
+  uint64_t timeouts;
+  uint64_t waitedns;
+  uint64_t cpuns;
+  uint64_t latencysum;
+  uint64_t latencymax;
+};
+
+
+#endif /* TRIGGERWAITER_H */
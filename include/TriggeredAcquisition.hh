@@ -31,8 +31,22 @@
 #include <cstdint>
 #include <cstring>
 #include <cmath>
+#include <thread>
+#include <atomic>
 
 #include "FPGAInterface.hh"
+#include "DevMemFPGAInterface.hh"
+#include "EventRing.hh"
+#include "TraceKernels.hh"
+#include "OutputFormats.hh"
+#include "Histogram.hh"
+#include "TraceCodec.hh"
+#include "TextFormat.hh"
+#include "AsyncWriter.hh"
+#include "BurstBuffer.hh"
+#include "StageProfiler.hh"
+#include "TriggerWaiter.hh"
+#include "RealtimeProfile.hh"
 
 /** enum definitions for possible settings */
 enum MeasurementLengthType {
@@ -57,11 +71,46 @@ enum WriteOffSetting {
   WRITE_OFF_BINARY_TRACE,
   WRITE_OFF_BINARY_MUL,
   WRITE_OFF_ASCII_INTEGRAL,
-  WRITE_OFF_JUST_CHECK
+  WRITE_OFF_JUST_CHECK,
+  WRITE_OFF_BINARY_INTEGRAL,
+  WRITE_OFF_HISTOGRAM
+};
+
+enum ChannelSetting {
+  CHANNEL_A = CHANNELS_A,
+  CHANNEL_B = CHANNELS_B,
+  CHANNEL_BOTH = CHANNELS_BOTH
+};
+
+enum CoincidenceSetting {
+  COINC_OFF,
+  COINC_REQUIRE,   // keep events with a pulse on channel B
+  COINC_VETO       // keep events without a pulse on channel B (anti-coincidence)
+};
+
+enum AcquisitionSetting {
+  ACQ_DIRECT,
+  ACQ_COPY_OUT,
+  ACQ_PIPELINE,
+  ACQ_BURST,
+  ACQ_STREAM
+};
+
+/** Summary of the last run of Measure() or Geiger() */
+struct RunStatistics {
+  int events;       // events recorded (including rejected ones)
+  int rejected;     // events that failed the rejection
+  double realtime;  // s
+  double livetime;  // s
 };
 
 const int BUF = 16*1024;
 const int MULBUF = 64;
+const int RECORDBUF = 4096;
+const int STREAMGUARD = 1024; // samples kept free between reader and writer in streaming mode
+const uint64_t RATEWINDOW = 100000000; // window for the peak trigger rate in ns
+const double GEIGERWAITCHECK = 1; // s, longest wait for a count in counter mode without -W timeout
+const int TRACEBLOCKBUF = 256*1024;
 
 class TriggeredAcquisition
 {
@@ -73,6 +122,7 @@ public:
   void Geiger(float length = 10, MeasurementLengthType mlt = LENGTH_IS_TIME);
   int MeasureCalibrationA();
   int MeasureCalibrationB();
+  int Replay(uint32_t * ring, const int * trigptrs, int ntriggers, int events);
 
   void SetRejectionParameters(float rmin, float rmax, int cstart, int cend);
   void SetRejectionParameters(float rmin, float rmax, int cstart, int cend, float bend);
@@ -101,19 +151,133 @@ public:
   void SetWriteOff(WriteOffSetting ws);
   WriteOffSetting GetWriteOff() { return writeoff; }
 
+  void SetAcquisition(AcquisitionSetting as);
+  AcquisitionSetting GetAcquisition() { return acquisition; }
+
+  void SetChannel(ChannelSetting cs);
+  ChannelSetting GetChannel() { return channel; }
+
+  void SetCoincidence(CoincidenceSetting cs, int window, int threshold);
+  CoincidenceSetting GetCoincidence() { return coincidence; }
+  int GetCoincidenceWindow() { return coincwindow; }
+
+  void SetRingSlots(int n);
+  int GetRingSlots() { return ringslots; }
+
+  void SetHoldoff(int samples);
+  int GetHoldoff() { return holdoff; }
+
+  void SetCaptureLength(int samples);
+  int GetCaptureLength() { return capturelength; }
+
+  void SetBurstMemory(int megabytes);
+  int GetBurstMemory() { return burstmemory; }
+  void SetBurstHugePages(bool on) { bursthugepages = on; }
+
+  void SetWaitSettings(const WaitSettings & ws);
+  const WaitSettings & GetWaitSettings() { return waiter.GetSettings(); }
+  TriggerWaiter & GetWaiter() { return waiter; }
+
+  void SetRealtimeSettings(const RealtimeSettings & rs);
+  const RealtimeSettings & GetRealtimeSettings() { return realtime.GetSettings(); }
+  RealtimeProfile & GetRealtimeProfile() { return realtime; }
+
+  void SetMulBatch(int n);
+  int GetMulBatch() { return mulbatch; }
+
+  void SetWriterSettings(const WriterSettings & ws);
+  const WriterSettings & GetWriterSettings() { return out.GetSettings(); }
+  AsyncWriter & GetWriter() { return out; }
+
+  void SetHistogram(int bins, double min, double max);
+  void SetPeakHistogram(bool on);
+  void SetSnapshotInterval(double s);
+  double GetSnapshotInterval() { return snapshotinterval; }
+
+  // counter mode (Geiger())
+  void SetRateInterval(double s);
+  double GetRateInterval() { return rateinterval; }
+  void SetIntervalHistogram(int bins, double max);
+
   void SetFilename(std::string filen);
   std::string GetFilename() { return filename; }
+
+  void SetInterface(FPGAInterface * fi);
+  FPGAInterface * GetInterface() { return iface; }
+
+  const RunStatistics & GetRunStatistics() { return runstats; }
   
 
-  inline void WriteOffBinarySingle();
-  inline void WriteOffAsciiSingle();
-  inline bool WriteOffAsciiIntegral();
-  inline void WriteOffJustCheck();
+  inline void ExtractTrace(uint32_t * src, int trigptr, int16_t * dest);
+  inline void ExtractEvent(int trigptr, int16_t * dest);
+  inline bool WriteOff();
+  int WriteOffCapture(int16_t * window, int maxevents, int & discarded);
+  inline void CountRate();
+
+  // Per event processing, n is the trace length (a compile time
+  // constant where the pipeline is specialized on it)
+  inline void WriteOffBinarySingle(int n);
+  inline void WriteOffBinaryMul(int n);
+  inline void WriteOffBinaryTrace(int n);
+  inline void WriteOffAsciiSingle(int n);
+  inline bool Integrate(int n, TraceIntegral & ti, double & total, int & peak);
+  inline bool WriteOffAsciiIntegral(int n);
+  inline bool WriteOffBinaryIntegral(int n);
+  inline bool WriteOffHistogram(int n);
+  void FlushRecords();
+  void FlushMul();
+  void FlushTraceBlock();
+  inline void WriteOffJustCheck(int n);
   
   void DumpSettings();
-  std::string triggerString(TriggerSetting ts);
+  static std::string triggerString(TriggerSetting ts);
+  static std::string channelString(ChannelSetting cs);
+  /**
+   * First lines of the header of the ASCII output files (output methods
+   * 0 and 4), shared with the offline tools writing the same layout
+   */
+  static std::string textHeader(int decimation, int tracelength, int pretriggerlength,
+				int triggervalue, TriggerSetting trigger);
 
 private:
+  void MeasurePipeline(float length, MeasurementLengthType mlt,
+		       std::chrono::high_resolution_clock::time_point starttime,
+		       int & runcount, int & discarded,
+		       std::chrono::high_resolution_clock::duration & deadtime);
+  bool SetupDiscriminator();
+  bool SetupCoincidence();
+  inline bool CoincidenceTest(const uint32_t * ring, int position);
+  inline bool CoincidenceTest(const int16_t * capture, int n, int position);
+  inline bool CoincidenceKeep(bool pulse);
+  uint64_t TriggerSampleTime(const EventTiming & t, uint32_t armwp, uint32_t trigptr, int posttrigger);
+  void WriteRunFooter(int events, int rejected, double realtime);
+  bool OpenOutput();
+  void CloseOutput(int runcount, int discarded, double realtime);
+
+  // Processing pipeline of an event, selected once per run
+  typedef bool (TriggeredAcquisition::*WriteOffFunction)();
+  void SelectWriteOff();
+  template<WriteOffSetting MODE> WriteOffFunction SelectTraceLength();
+  template<WriteOffSetting MODE, int LENGTH> bool WriteOffEvent();
+  WriteOffFunction writeofffn;
+  int peakstart;
+  int peakend;
+
+  // Recorded channels, the traces of an event follow each other
+  void SelectChannels(uint32_t * a, uint32_t * b);
+  bool WriteOffChannels();
+  WriteOffFunction channelfn;  // pipeline of a single trace
+  uint32_t * measuresrc[2];
+  int nchannels;
+  int channelstride;           // samples from one trace of an event to the next
+  int channelslot;             // trace of the event being processed
+  uint32_t channelflags[2];    // IntegralRecord flags of the traces
+  int discslot;                // trace with the trigger signal, for the software trigger
+  void MeasureStream(float length, MeasurementLengthType mlt,
+		     std::chrono::high_resolution_clock::time_point starttime,
+		     int & runcount, int & discarded,
+		     std::chrono::high_resolution_clock::duration & deadtime);
+
   int decimation;
   int tracelength;
   int pretriggerlength;
@@ -121,6 +285,32 @@ private:
   int triggervalue;
   TriggerSetting trigger;
   WriteOffSetting writeoff;
+  AcquisitionSetting acquisition;
+  ChannelSetting channel;
+  int ringslots;
+  int holdoff;
+  int capturelength;
+  bool discrising;
+  int discthreshold;
+  int dischold;
+  int burstmemory;
+  bool bursthugepages;
+  BurstBuffer burst;
+  TriggerWaiter waiter;
+  bool waitexplicit;
+  RealtimeProfile realtime;
+  void PrepareRealtime();
+  void FinishRealtime();
+
+  // A / B coincidence filter
+  CoincidenceSetting coincidence;
+  int coincwindow;             // samples before and after the channel A trigger
+  int coincthreshold;          // signed ADC value
+  bool coincrising;
+  int coincslot;               // capture of channel B in long captures
+  int coincfound;              // events with a channel B pulse in the window
+  int coincmissing;            // events without
+  int coincvetoed;             // events not recorded because of the filter
 
   float ratiomin;
   float ratiomax;
@@ -140,14 +330,49 @@ private:
 
   // write off variables
   int data [BUF];
-  int* datam;
   int* datamb;
-  FILE * fh;
+  int16_t * tracebuf [2];
+  int16_t * trace;
+  EventTiming timing;
+  std::atomic<uint64_t> livetime; // ns the acquisition was ready for a trigger
+  uint64_t ratewindowstart;
+  int ratecount;
+  int ratepeak;
+  IntegralRecord * records;
+  int recordcount;
+
+  // histogram (multichannel analyzer) mode
+  void Snapshot();
+  void SaveSpectra(Histogram * hint, Histogram * hpeak, double realtime, double live);
+  std::string SpectrumName(int slot, std::string suffix);
+  Histogram inthist[2];  // per recorded channel
+  Histogram peakhist[2];
+  Histogram snapint[2];
+  Histogram snappeak[2];
+  bool histpeak;
+  double snapshotinterval;
+  double rateinterval;
+  Histogram intervalhist;
+  uint64_t nextsnapshot;
+  std::thread snapshotthread;
+  std::atomic<bool> snapshotbusy;
+  int snapshotsskipped;
+  AsyncWriter out;
+
+  // stage latencies, only filled with ENABLE_PROFILING
+  void DumpProfile(const std::string & run);
+  StageProfiler profiler;
+  RunStatistics runstats;
 
   //int * signal_start_ptr;
   uint32_t * signal_start_ptr;
   int trig_ptr;
   int mulcount;
+  int mulbatch;
+  int mulalloc;
+  uint8_t * blockbuf;
+  int blockbytes;
+  int blocktraces;
 };
 
 
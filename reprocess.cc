@@ -0,0 +1,337 @@
+/*
+ * acquisition - RedPitaya Data Acquisition
+ *
+ *
+ * Copyright (C) 2016, 2017 Moritz Kütt, Malte Göttsche, Alexander Glaser
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: moritz@nuclearfreesoftware.org
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "TriggeredAcquisition.hh"
+#include "TraceKernels.hh"
+#include "Histogram.hh"
+#include "TextFormat.hh"
+#include "AsyncWriter.hh"
+
+/** Traces per thread and round, bounds the integral list held in memory */
+#define ROUNDTRACES (64 * 1024)
+
+/** Header of a binary trace file (acquisition -o 1 / -o 3) */
+struct BinaryTraceHeader {
+  int32_t decimation;
+  int32_t tracelength;
+  int32_t pretriggerlength;
+  float triggervoltage;
+  int32_t trigger;
+};
+
+/** Integration and rejection settings, same meaning as in acquisition */
+struct ReprocessSettings {
+  float ratiomin;
+  float ratiomax;
+  int channelstart;
+  int channelend;
+  float curvebend;
+  bool list;
+  bool peaks;
+  int bins;
+  double min;
+  double max;
+};
+
+/** Results of one thread, for a contiguous range of traces */
+struct ReprocessChunk {
+  Histogram * inthist;
+  Histogram * peakhist;
+  std::string text;
+  uint64_t accepted;
+};
+
+void usage() {
+      std::cout << "Usage:" << std::endl;
+      std::cout << "reprocess [options] <tracefile.bin> [<tracefile.bin> ...]" << std::endl;
+      std::cout << std::endl;
+      std::cout << "Integrates the traces of a binary file written by 'acquisition -o 1' (or -o 3)" << std::endl;
+      std::cout << "with the integration and rejection of 'acquisition -o 4', on all cores." << std::endl;
+      std::cout << "Writes the integral spectrum to <tracefile>.spectrum." << std::endl;
+      std::cout << std::endl;
+      std::cout << "Options:" << std::endl;
+      std::cout << "   -r <min> <max> <s> <e> rejection parameters, as acquisition -r" << std::endl;
+      std::cout << "   -s <min> <max> <s> <e> <b>  rejection parameters, as acquisition -s" << std::endl;
+      std::cout << "   -H <bins> <min> <max>  binning of the integral spectrum (default 1024 0 131072)" << std::endl;
+      std::cout << "   -k                     also write the peak amplitude spectrum to <tracefile>.peaks" << std::endl;
+      std::cout << "   -l                     also write the integral list to <tracefile>.integral.txt" << std::endl;
+      std::cout << "   -j <threads>           number of threads (default number of cores)" << std::endl;
+}
+
+/** Integration, rejection and filling for traces [first, last) */
+static void ProcessChunk(const int32_t * data, const BinaryTraceHeader & header, const ReprocessSettings & rs,
+			 uint64_t first, uint64_t last, ReprocessChunk & chunk) {
+  int n = header.tracelength;
+  int startp = header.pretriggerlength;
+  int endp = n;
+  if(rs.channelstart != -1) {
+    startp = rs.channelstart;
+    endp = rs.channelend;
+  }
+  std::vector<int16_t> trace(n);
+  char line[MAXTEXTFIXED + 2];
+  for(uint64_t t = first; t < last; t++) {
+    const int32_t * raw = data + t * n;
+    for(int i = 0; i < n; i++) {
+      trace[i] = SignedSample(raw[i]);
+    }
+    TraceIntegral ti;
+    double total;
+    int peak;
+    IntegrateTrace(trace.data(), n, BASELINELENGTH, startp, endp, ti);
+    SubtractBaseline(ti, n, BASELINELENGTH, total, peak);
+    if(!AcceptPulse(total, peak, rs.ratiomin, rs.ratiomax, rs.curvebend)) {
+      continue;
+    }
+    chunk.accepted++;
+    chunk.inthist->Fill(fabs(total));
+    if(rs.peaks) {
+      chunk.peakhist->Fill(peak);
+    }
+    if(rs.list) {
+      char * p = FormatFixed(line, total);
+      *p++ = '\n';
+      chunk.text.append(line, p - line);
+    }
+  }
+}
+
+static bool Reprocess(std::string file, const ReprocessSettings & rs, int threads) {
+  int fd = open(file.c_str(), O_RDONLY);
+  if(fd < 0) {
+    std::cout << "Error: Could not open " << file << std::endl;
+    return false;
+  }
+  struct stat st;
+  if(fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(BinaryTraceHeader)) {
+    std::cout << "Error: " << file << " is too short for a trace file" << std::endl;
+    close(fd);
+    return false;
+  }
+  size_t size = st.st_size;
+  void * map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED) {
+    std::cout << "Error: Could not map " << file << " (" << strerror(errno) << ")" << std::endl;
+    return false;
+  }
+  madvise(map, size, MADV_SEQUENTIAL);
+
+  BinaryTraceHeader header;
+  memcpy(&header, map, sizeof(header));
+  if(header.tracelength < 1 || header.tracelength > 16384 || header.pretriggerlength < 0
+     || header.pretriggerlength > header.tracelength) {
+    std::cout << "Error: " << file << " has no valid trace file header" << std::endl;
+    munmap(map, size);
+    return false;
+  }
+  const int32_t * data = (const int32_t *) ((char *) map + sizeof(header));
+  size_t tracebytes = header.tracelength * sizeof(int32_t);
+  uint64_t traces = (size - sizeof(header)) / tracebytes;
+  if((size - sizeof(header)) % tracebytes != 0) {
+    std::cout << "Warning: " << file << " ends with an incomplete trace, ignored" << std::endl;
+  }
+  std::cout << file << ": " << traces << " traces of " << header.tracelength << " samples, decimation "
+	    << header.decimation << ", pretrigger " << header.pretriggerlength << std::endl;
+
+  std::string base = file;
+  if(base.size() > 4 && base.compare(base.size() - 4, 4, ".bin") == 0) {
+    base.erase(base.size() - 4);
+  }
+  bool ok = true;
+  AsyncWriter list;
+  if(rs.list) {
+    // Same layout as acquisition -o 4. The .bin header only has the
+    // trigger voltage, converted like acquisition -u (not the value set
+    // with acquisition -v)
+    std::string listfile = base + ".integral.txt";
+    if(!list.Open(listfile)) {
+      std::cout << "Error: Could not open " << listfile << std::endl;
+      munmap(map, size);
+      return false;
+    }
+    int tv = (int) round(8192 * header.triggervoltage / 14.0);
+    std::string text = TriggeredAcquisition::textHeader(header.decimation, header.tracelength, header.pretriggerlength,
+							tv < 0 ? tv + 16384 : tv, (TriggerSetting) header.trigger);
+    list.Write(text.data(), text.size());
+    list.Printf("Rej. Param. <min>     %f\n", rs.ratiomin);
+    list.Printf("Rej. Param. <max>     %f\n", rs.ratiomax);
+    list.Printf("Rej. Param. <s>       %d\n", rs.channelstart);
+    list.Printf("Rej. Param. <e>       %d\n", rs.channelend);
+  }
+
+  // Rounds of contiguous chunks, one per thread; results are merged in
+  // file order, the integral list after every round
+  if((uint64_t) threads > traces) {
+    threads = traces > 0 ? traces : 1;
+  }
+  std::vector<ReprocessChunk> chunks(threads);
+  for(int c = 0; c < threads; c++) {
+    chunks[c].inthist = new Histogram(rs.bins, rs.min, rs.max);
+    chunks[c].peakhist = new Histogram(1024, 0, 8192);
+    chunks[c].accepted = 0;
+  }
+  std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+  uint64_t round = (uint64_t) threads * ROUNDTRACES;
+  for(uint64_t begin = 0; begin < traces; begin += round) {
+    uint64_t end = begin + round < traces ? begin + round : traces;
+    std::vector<std::thread> workers;
+    for(int c = 0; c < threads; c++) {
+      uint64_t first = begin + (end - begin) * c / threads;
+      uint64_t last = begin + (end - begin) * (c + 1) / threads;
+      workers.push_back(std::thread(ProcessChunk, data, std::cref(header), std::cref(rs), first, last, std::ref(chunks[c])));
+    }
+    for(int c = 0; c < threads; c++) {
+      workers[c].join();
+    }
+    if(rs.list) {
+      for(int c = 0; c < threads; c++) {
+	list.Write(chunks[c].text.data(), chunks[c].text.size());
+	chunks[c].text.clear();
+      }
+    }
+  }
+  if(rs.list && !list.Close()) {
+    ok = false;
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  munmap(map, size);
+
+  uint64_t accepted = 0;
+  for(int c = 1; c < threads; c++) {
+    chunks[0].inthist->Add(*chunks[c].inthist);
+    chunks[0].peakhist->Add(*chunks[c].peakhist);
+  }
+  for(int c = 0; c < threads; c++) {
+    accepted += chunks[c].accepted;
+  }
+  std::cout << "Processed " << size / 1e6 << " MB in " << seconds << " s (" << size / 1e6 / seconds << " MB/s, "
+	    << threads << " threads), accepted " << accepted << ", discarded " << traces - accepted << std::endl;
+
+  ok = chunks[0].inthist->Save(base + ".spectrum", "Integral spectrum, baseline subtracted, reprocessed from " + file, 0, 0) && ok;
+  if(rs.peaks) {
+    ok = chunks[0].peakhist->Save(base + ".peaks", "Peak amplitude spectrum, baseline subtracted, reprocessed from " + file, 0, 0) && ok;
+  }
+  for(int c = 0; c < threads; c++) {
+    delete chunks[c].inthist;
+    delete chunks[c].peakhist;
+  }
+  return ok;
+}
+
+int main(int argc, char **argv)
+{
+  ReprocessSettings rs;
+  // Defaults of acquisition
+  rs.ratiomin = 0;
+  rs.ratiomax = 1e6;
+  rs.channelstart = 0;
+  rs.channelend = 8192;
+  rs.curvebend = 0;
+  rs.list = false;
+  rs.peaks = false;
+  rs.bins = 1024;
+  rs.min = 0;
+  rs.max = 131072;
+  // hardware_concurrency() is 0 if unknown
+  int threads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::string> files;
+
+  for ( int i=1; i<argc; i=i+1 ) {
+    if ( std::string(argv[i]) == "-h" || std::string(argv[i]) == "--help") {
+      usage();
+      return 0;
+    }
+    else if ( std::string(argv[i]) == "-r" && i + 4 < argc ) {
+      rs.ratiomin = std::atof(argv[i+1]);
+      rs.ratiomax = std::atof(argv[i+2]);
+      rs.channelstart = std::atof(argv[i+3]);
+      rs.channelend = std::atof(argv[i+4]);
+      rs.curvebend = 0;
+      i += 4;
+    }
+    else if ( std::string(argv[i]) == "-s" && i + 5 < argc ) {
+      rs.ratiomin = std::atof(argv[i+1]);
+      rs.ratiomax = std::atof(argv[i+2]);
+      rs.channelstart = std::atof(argv[i+3]);
+      rs.channelend = std::atof(argv[i+4]);
+      rs.curvebend = std::atof(argv[i+5]);
+      i += 5;
+    }
+    else if ( std::string(argv[i]) == "-H" && i + 3 < argc ) {
+      rs.bins = std::atoi(argv[i+1]);
+      rs.min = std::atof(argv[i+2]);
+      rs.max = std::atof(argv[i+3]);
+      i += 3;
+    }
+    else if ( std::string(argv[i]) == "-k" ) {
+      rs.peaks = true;
+    }
+    else if ( std::string(argv[i]) == "-l" ) {
+      rs.list = true;
+    }
+    else if ( std::string(argv[i]) == "-j" && i + 1 < argc ) {
+      threads = std::atoi(argv[i+1]);
+      i += 1;
+    }
+    else {
+      files.push_back(argv[i]);
+    }
+  }
+  if(files.empty()) {
+    usage();
+    return -1;
+  }
+  if(rs.bins < 1 || rs.max <= rs.min) {
+    std::cout << "Error: Invalid histogram binning" << std::endl;
+    return -1;
+  }
+  if(threads < 1) {
+    std::cout << "Error: Number of threads must be at least 1" << std::endl;
+    return -1;
+  }
+
+  int failed = 0;
+  for(size_t f = 0; f < files.size(); f++) {
+    if(!Reprocess(files[f], rs, threads)) {
+      failed++;
+    }
+  }
+  return failed > 0 ? -1 : 0;
+}
@@ -0,0 +1,335 @@
+/*
+ * acquisition - RedPitaya Data Acquisition
+ *
+ *
+ * Copyright (C) 2016, 2017 Moritz Kütt, Malte Göttsche, Alexander Glaser
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: moritz@nuclearfreesoftware.org
+ */
+
+
+#include "AsyncWriter.hh"
+#include "RealtimeProfile.hh"
+
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdarg>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+typedef std::chrono::steady_clock writerclock;
+
+static uint64_t NsSince(writerclock::time_point t0) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(writerclock::now() - t0).count();
+}
+
+AsyncWriter::AsyncWriter() {
+  settings.buffersize = 1024 * 1024;
+  settings.buffers = 4;
+  settings.direct = false;
+  settings.preallocate = 0;
+  settings.syncinterval = 0;
+  fd = -1;
+  failed = false;
+  cur = -1;
+  curfill = 0;
+  logicalsize = 0;
+  spill = NULL;
+  spillsize = 0;
+  spilled = false;
+  stopping = false;
+  byteswritten = 0;
+  flushes = 0;
+  flushtime = 0;
+  flushmax = 0;
+  stalls = 0;
+  stalltime = 0;
+}
+
+AsyncWriter::~AsyncWriter() {
+  Close();
+  FreeBuffers();
+  free(spill);
+}
+
+void AsyncWriter::SetSettings(const WriterSettings & s) {
+  if(IsOpen()) {
+    std::cout << "Error: Writer settings can not be changed while a file is open" << std::endl;
+    return;
+  }
+  if(s.buffersize != settings.buffersize || s.buffers != settings.buffers) {
+    FreeBuffers();
+  }
+  settings = s;
+}
+
+void AsyncWriter::FreeBuffers() {
+  for(size_t i = 0; i < buffers.size(); i++) {
+    free(buffers[i]);
+  }
+  buffers.clear();
+}
+
+bool AsyncWriter::Open(const std::string & file) {
+  Close();
+  if(buffers.empty()) {
+    for(int i = 0; i < settings.buffers; i++) {
+      void * mem = NULL;
+      if(posix_memalign(&mem, WRITERALIGN, settings.buffersize) != 0) {
+	std::cout << "Error: Could not allocate " << settings.buffers << " output buffers of " << settings.buffersize << " bytes" << std::endl;
+	FreeBuffers();
+	return false;
+      }
+      buffers.push_back((char *) mem);
+    }
+  }
+
+  int flags = O_WRONLY | O_CREAT | O_TRUNC;
+  if(settings.direct) {
+    fd = open(file.c_str(), flags | O_DIRECT, 0644);
+    if(fd < 0) {
+      std::cout << "Warning: O_DIRECT not supported for " << file << ", using buffered I/O" << std::endl;
+    }
+  }
+  if(fd < 0) {
+    fd = open(file.c_str(), flags, 0644);
+  }
+  if(fd < 0) {
+    std::cout << "Error: Could not open " << file << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+  if(settings.preallocate > 0) {
+    if(fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, settings.preallocate) != 0) {
+      std::cout << "Warning: Could not preallocate " << settings.preallocate << " bytes: " << strerror(errno) << std::endl;
+    }
+  }
+  path = file;
+  failed = false;
+
+  fills.assign(buffers.size(), 0);
+  fullbuffers.clear();
+  freebuffers.clear();
+  for(size_t i = 1; i < buffers.size(); i++) {
+    freebuffers.push_back(i);
+  }
+  cur = 0;
+  curfill = 0;
+  logicalsize = 0;
+  spilled = false;
+  stopping = false;
+  byteswritten = 0;
+  flushes = 0;
+  flushtime = 0;
+  flushmax = 0;
+  stalls = 0;
+  stalltime = 0;
+  writer = std::thread(&AsyncWriter::Run, this);
+  return true;
+}
+
+bool AsyncWriter::Close() {
+  if(!IsOpen()) {
+    return true;
+  }
+  if(curfill > 0) {
+    // O_DIRECT only writes whole blocks, pad with zeros and truncate later
+    if(settings.direct) {
+      size_t padded = (curfill + WRITERALIGN - 1) / WRITERALIGN * WRITERALIGN;
+      memset(buffers[cur] + curfill, 0, padded - curfill);
+      curfill = padded;
+    }
+    fills[cur] = curfill;
+    std::unique_lock<std::mutex> lock(mtx);
+    fullbuffers.push_back(cur);
+    cvfull.notify_one();
+  }
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    stopping = true;
+    cvfull.notify_one();
+  }
+  writer.join();
+  cur = -1;
+  curfill = 0;
+
+  if(settings.direct && ftruncate(fd, logicalsize) != 0) {
+    failed = true;
+  }
+  if(settings.syncinterval > 0 && fdatasync(fd) != 0) {
+    failed = true;
+  }
+  if(close(fd) != 0) {
+    failed = true;
+  }
+  fd = -1;
+  if(failed) {
+    std::cout << "Error: Writing " << path << " failed, output is incomplete" << std::endl;
+  }
+  return !failed;
+}
+
+void AsyncWriter::Submit() {
+  fills[cur] = curfill;
+  std::unique_lock<std::mutex> lock(mtx);
+  fullbuffers.push_back(cur);
+  cvfull.notify_one();
+  if(freebuffers.empty()) {
+    writerclock::time_point t0 = writerclock::now();
+    while(freebuffers.empty()) {
+      cvfree.wait(lock);
+    }
+    stalls++;
+    stalltime += NsSince(t0);
+  }
+  cur = freebuffers.front();
+  freebuffers.pop_front();
+  curfill = 0;
+}
+
+void AsyncWriter::Write(const void * data, size_t n) {
+  const char * src = (const char *) data;
+  logicalsize += n;
+  while(n > 0) {
+    size_t chunk = settings.buffersize - curfill;
+    if(chunk > n) {
+      chunk = n;
+    }
+    memcpy(buffers[cur] + curfill, src, chunk);
+    curfill += chunk;
+    src += chunk;
+    n -= chunk;
+    if(curfill == settings.buffersize) {
+      Submit();
+    }
+  }
+}
+
+void AsyncWriter::Printf(const char * format, ...) {
+  char line[1024];
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  if(n > 0) {
+    Write(line, (size_t) n < sizeof(line) ? n : sizeof(line) - 1);
+  }
+}
+
+char * AsyncWriter::Reserve(size_t n) {
+  if(curfill + n <= settings.buffersize) {
+    spilled = false;
+    return buffers[cur] + curfill;
+  }
+  // Does not fit into the current buffer, buffers are always written
+  // completely full, so collect it separately and copy it over
+  if(spillsize < n) {
+    free(spill);
+    spill = (char *) malloc(n);
+    spillsize = n;
+  }
+  spilled = true;
+  return spill;
+}
+
+void AsyncWriter::Commit(size_t n) {
+  if(spilled) {
+    spilled = false;
+    Write(spill, n);
+    return;
+  }
+  curfill += n;
+  logicalsize += n;
+  if(curfill == settings.buffersize) {
+    Submit();
+  }
+}
+
+void AsyncWriter::Prefault() {
+  // Buffers the writer thread is not working on
+  std::lock_guard<std::mutex> lock(mtx);
+  for(size_t i = 0; i < freebuffers.size(); i++) {
+    RealtimeProfile::Prefault(buffers[freebuffers[i]], settings.buffersize);
+  }
+  // No current buffer after Close()
+  if(cur >= 0) {
+    RealtimeProfile::Prefault(buffers[cur], settings.buffersize);
+  }
+}
+
+bool AsyncWriter::WriteBuffer(const char * buf, size_t n) {
+  while(n > 0) {
+    ssize_t done = write(fd, buf, n);
+    if(done < 0) {
+      if(errno == EINTR) {
+	continue;
+      }
+      return false;
+    }
+    buf += done;
+    n -= done;
+  }
+  return true;
+}
+
+void AsyncWriter::Run() {
+  uint64_t sincesync = 0;
+  std::unique_lock<std::mutex> lock(mtx);
+  while(true) {
+    while(fullbuffers.empty() && !stopping) {
+      cvfull.wait(lock);
+    }
+    if(fullbuffers.empty()) {
+      break;
+    }
+    int b = fullbuffers.front();
+    fullbuffers.pop_front();
+    lock.unlock();
+
+    writerclock::time_point t0 = writerclock::now();
+    bool ok = WriteBuffer(buffers[b], fills[b]);
+    sincesync++;
+    if(ok && settings.syncinterval > 0 && sincesync >= (uint64_t) settings.syncinterval) {
+      ok = (fdatasync(fd) == 0);
+      sincesync = 0;
+    }
+    uint64_t latency = NsSince(t0);
+
+    lock.lock();
+    if(!ok) {
+      failed = true;
+    }
+    byteswritten += fills[b];
+    flushes++;
+    flushtime += latency;
+    if(latency > flushmax) {
+      flushmax = latency;
+    }
+    freebuffers.push_back(b);
+    cvfree.notify_one();
+  }
+}
+
+void AsyncWriter::DumpStatistics() {
+  std::cout << "Output: " << byteswritten / 1e6 << " MB in " << flushes << " writes, write latency "
+	    << GetMeanFlushLatency() * 1e3 << " ms mean, " << GetMaxFlushLatency() * 1e3 << " ms max" << std::endl;
+  if(stalls > 0) {
+    std::cout << "Output: all buffers full " << stalls << " times, acquisition waited " << GetStallTime() * 1e3 << " ms" << std::endl;
+  }
+}
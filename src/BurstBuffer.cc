@@ -0,0 +1,125 @@
+/*
+ * acquisition - RedPitaya Data Acquisition
+ *
+ *
+ * Copyright (C) 2016, 2017 Moritz Kütt, Malte Göttsche, Alexander Glaser
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: moritz@nuclearfreesoftware.org
+ */
+
+
+#include "BurstBuffer.hh"
+
+#include <iostream>
+#include <cstring>
+#include <sys/mman.h>
+
+#define HUGEPAGESIZE (2 * 1024 * 1024)
+
+BurstBuffer::BurstBuffer() {
+  mem = NULL;
+  bytes = 0;
+  huge = false;
+  locked = false;
+  times = NULL;
+  traces = NULL;
+  slotsamples = 0;
+  capacity = 0;
+  count = 0;
+}
+
+BurstBuffer::~BurstBuffer() {
+  Free();
+}
+
+bool BurstBuffer::Allocate(size_t size, bool hugepages) {
+  Free();
+  void * m = MAP_FAILED;
+  if(hugepages) {
+    size_t hugesize = (size + HUGEPAGESIZE - 1) / HUGEPAGESIZE * HUGEPAGESIZE;
+    m = mmap(NULL, hugesize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(m != MAP_FAILED) {
+      size = hugesize;
+      huge = true;
+    }
+    else {
+      std::cout << "Warning: No huge pages available (see /proc/sys/vm/nr_hugepages), using normal pages" << std::endl;
+    }
+  }
+  if(m == MAP_FAILED) {
+    m = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(m == MAP_FAILED) {
+      std::cout << "Error: Could not reserve " << size / (1024 * 1024) << " MB for burst capture" << std::endl;
+      return false;
+    }
+#ifdef MADV_HUGEPAGE
+    if(hugepages) {
+      madvise(m, size, MADV_HUGEPAGE);
+    }
+#endif
+  }
+  mem = (char *) m;
+  bytes = size;
+
+  // Touch every page now, not during the measurement
+  memset(mem, 0, bytes);
+  // Only this region: mlockall() / munlockall() would change the lock
+  // of the real-time profile (-Q) as well
+  if(mlock(mem, bytes) == 0) {
+    locked = true;
+  }
+  else {
+    std::cout << "Warning: Could not lock memory (needs root or a higher RLIMIT_MEMLOCK), pages may be swapped" << std::endl;
+  }
+  return true;
+}
+
+void BurstBuffer::Free() {
+  if(mem) {
+    if(locked) {
+      munlock(mem, bytes);
+    }
+    munmap(mem, bytes);
+  }
+  mem = NULL;
+  bytes = 0;
+  huge = false;
+  locked = false;
+  times = NULL;
+  traces = NULL;
+  capacity = 0;
+  count = 0;
+}
+
+void BurstBuffer::Prepare(int samples) {
+  count = 0;
+  capacity = 0;
+  if(!mem) {
+    return;
+  }
+  // Slots start on cache line boundaries
+  slotsamples = (samples + 31) & ~31;
+  size_t perevent = slotsamples * sizeof(int16_t) + sizeof(EventTiming);
+  size_t n = (bytes - 64) / perevent;
+  if(n > 0x7fffffff) {
+    n = 0x7fffffff;
+  }
+  capacity = n;
+  times = (EventTiming *) mem;
+  // traces behind the timing, 64 byte aligned
+  size_t offset = (capacity * sizeof(EventTiming) + 63) & ~((size_t) 63);
+  traces = (int16_t *) (mem + offset);
+}
@@ -0,0 +1,58 @@
+/*
+ * acquisition - RedPitaya Data Acquisition
+ *
+ *
+ * Copyright (C) 2016, 2017 Moritz Kütt, Malte Göttsche, Alexander Glaser
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: moritz@nuclearfreesoftware.org
+ */
+
+
+#include "EventRing.hh"
+
+#include <cstdlib>
+#include <cstring>
+
+EventRing::EventRing(int slotcount, int samplecount) {
+  size = 1;
+  while(size < slotcount) {
+    size <<= 1;
+  }
+  mask = size - 1;
+
+  // Slots start on cache line boundaries
+  slotsamples = (samplecount + 31) & ~31;
+  void * mem = NULL;
+  if(posix_memalign(&mem, 64, (size_t) size * slotsamples * sizeof(int16_t)) != 0) {
+    mem = NULL;
+  }
+  samples = (int16_t *) mem;
+  if(samples) {
+    // Touch every page now, not during the measurement
+    memset(samples, 0, (size_t) size * slotsamples * sizeof(int16_t));
+  }
+  slots = new EventSlot[size];
+  for(int i = 0; i < size; i++) {
+    slots[i].samples = samples ? samples + (size_t) i * slotsamples : NULL;
+  }
+  head = 0;
+  tail = 0;
+}
+
+EventRing::~EventRing() {
+  delete [] slots;
+  free(samples);
+}
@@ -23,87 +23,32 @@
 
 #include "FPGAInterface.hh"
 
-#include <stdint.h>
-#include <sys/mman.h>
-#include <unistd.h>
-#include <fcntl.h>
-#include <errno.h>
-#include <string.h>
 #include <cstddef>
 #include <iostream>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
 
 FPGAInterface::FPGAInterface() {
 
+  // Housekeeping module
+  hinit = false;
+  hmem = NULL;
+
   // Oscilloscope module
   oinit = false;
-  omem_fd = -1;
   omem = NULL;
   ochA = NULL;
   ochB = NULL;
+  atomicconfig = false;
+  irq_fd = -1;
 }
 
 FPGAInterface::~FPGAInterface() {
-  stopOscilloscope();
-}
-
-int FPGAInterface::initOscilloscope() {
-  // Basically this method is taken from the RedPitaya Github repository:
-
-  // Clean up before Opening
-  if(stopOscilloscope() < 0) {
-    return -1;
-  }
-
-  void *fpgaptr;
-  long pageaddress;
-  long pageoffset;
-  long pagesize = sysconf(_SC_PAGESIZE);
-
-  // Open /dev/mem
-  omem_fd = open("/dev/mem", O_RDWR | O_SYNC);
-  if(omem_fd < 0) {
-    std::cout << "Error opening /dev/mem" << std::endl;
-    return -1;
-  }
-
-  pageaddress = OSCBASE & (~(pagesize-1));
-  pageoffset = OSCBASE - pageaddress;
-
-  fpgaptr = mmap(NULL, OSCBASESIZE, PROT_READ | PROT_WRITE, MAP_SHARED, omem_fd, pageaddress);
-
-  if(fpgaptr == MAP_FAILED) {
-    std::cout << "Error while starting oscilloscope, mmap() error" << std::endl;
-    std::cout << strerror(errno);
-    stopOscilloscope();
-    return -1;
-  }
-
-  omem = (oscilloscope_mem*) (fpgaptr + pageoffset);
-  ochA = (uint32_t *)omem + (OSCCHAOFFSET / sizeof(uint32_t));
-  ochB = (uint32_t *)omem + (OSCCHBOFFSET / sizeof(uint32_t));
-
-  oinit = true;
-  return 0;
-}
-
-int FPGAInterface::stopOscilloscope() {
-  if(omem) {
-    if(munmap(omem, OSCBASESIZE) < 0) {
-      std::cout << "Error while stopping oscilloscope, munmap() error" << std::endl;
-      return -1;
-    }
-  }
-  omem = NULL;
-  ochA = NULL;
-  ochB = NULL;
-  if(omem_fd > 0) {
-    close(omem_fd);
-    omem_fd = -1;
-  }
-  return 0;
+  CloseInterrupt();
 }
 
-oscilloscope_mem * FPGAInterface::GetOscilloscopeMemory() {
+volatile oscilloscope_mem * FPGAInterface::GetOscilloscopeMemory() {
   if(oinit) {
     return omem;
   }
@@ -123,11 +68,49 @@ uint32_t * FPGAInterface::GetOscilloscopeChannelA() {
 
 uint32_t * FPGAInterface::GetOscilloscopeChannelB() {
   if(oinit) {
-    return ochA;
+    return ochB;
   }
   else {
     return NULL;
   }
 }
 
+bool FPGAInterface::OpenInterrupt(std::string device) {
+  CloseInterrupt();
+  irq_fd = open(device.c_str(), O_RDWR);
+  if(irq_fd < 0) {
+    std::cout << "Error opening interrupt device " << device << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void FPGAInterface::CloseInterrupt() {
+  if(irq_fd >= 0) {
+    close(irq_fd);
+    irq_fd = -1;
+  }
+}
+
+bool FPGAInterface::EnableInterrupt() {
+  // UIO: writing 1 re-enables the interrupt after it fired
+  uint32_t on = 1;
+  return irq_fd >= 0 && write(irq_fd, &on, sizeof(on)) == sizeof(on);
+}
 
+int FPGAInterface::WaitInterrupt(int timeoutms) {
+  if(irq_fd < 0) {
+    return -1;
+  }
+  struct pollfd pfd;
+  pfd.fd = irq_fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  int r = poll(&pfd, 1, timeoutms);
+  if(r <= 0) {
+    return r;
+  }
+  // Interrupt count, only read to acknowledge
+  uint32_t count;
+  return read(irq_fd, &count, sizeof(count)) == sizeof(count) ? 1 : -1;
+}
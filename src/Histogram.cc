@@ -0,0 +1,111 @@
+/*
+ * acquisition - RedPitaya Data Acquisition
+ *
+ *
+ * Copyright (C) 2016, 2017 Moritz Kütt, Malte Göttsche, Alexander Glaser
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: moritz@nuclearfreesoftware.org
+ */
+
+
+#include "Histogram.hh"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+Histogram::Histogram(int nbins, double min, double max) {
+  counts = NULL;
+  SetBinning(nbins, min, max);
+}
+
+Histogram::~Histogram() {
+  delete [] counts;
+}
+
+void Histogram::SetBinning(int nbins, double hmin, double hmax) {
+  if(nbins < 1 || hmax <= hmin) {
+    std::cout << "Error: Invalid histogram binning " << nbins << " bins, " << hmin << " to " << hmax << std::endl;
+    return;
+  }
+  delete [] counts;
+  bins = nbins;
+  min = hmin;
+  max = hmax;
+  scale = bins / (max - min);
+  counts = new uint32_t[bins];
+  Reset();
+}
+
+void Histogram::Reset() {
+  memset(counts, 0, bins * sizeof(uint32_t));
+  entries = 0;
+  underflow = 0;
+  overflow = 0;
+}
+
+void Histogram::CopyFrom(const Histogram & h) {
+  if(bins != h.bins) {
+    SetBinning(h.bins, h.min, h.max);
+  }
+  min = h.min;
+  max = h.max;
+  scale = h.scale;
+  memcpy(counts, h.counts, bins * sizeof(uint32_t));
+  entries = h.entries;
+  underflow = h.underflow;
+  overflow = h.overflow;
+}
+
+bool Histogram::Add(const Histogram & h) {
+  // Only histograms with the same binning can be added
+  if(bins != h.bins || min != h.min || max != h.max) {
+    std::cout << "Error: Cannot add histograms with different binning" << std::endl;
+    return false;
+  }
+  for(int i = 0; i < bins; i++) {
+    counts[i] += h.counts[i];
+  }
+  entries += h.entries;
+  underflow += h.underflow;
+  overflow += h.overflow;
+  return true;
+}
+
+bool Histogram::Save(std::string file, std::string title, double realtime, double livetime) {
+  std::string tmpfile = file + ".tmp";
+  FILE * f = fopen(tmpfile.c_str(), "w");
+  if(!f) {
+    std::cout << "Error: Could not open " << tmpfile << std::endl;
+    return false;
+  }
+  fprintf(f, "# %s\n", title.c_str());
+  fprintf(f, "# Real time [s]:       %f\n", realtime);
+  fprintf(f, "# Live time [s]:       %f\n", livetime);
+  fprintf(f, "# Entries:             %llu\n", (unsigned long long) entries);
+  fprintf(f, "# Underflow:           %llu\n", (unsigned long long) underflow);
+  fprintf(f, "# Overflow:            %llu\n", (unsigned long long) overflow);
+  fprintf(f, "# Bins:                %d\n", bins);
+  fprintf(f, "# Range:               %f %f\n", min, max);
+  fprintf(f, "# <lower bin edge> <counts>\n");
+  for(int i = 0; i < bins; i++) {
+    fprintf(f, "%f %u\n", min + i / scale, counts[i]);
+  }
+  if(fclose(f) != 0) {
+    return false;
+  }
+  return rename(tmpfile.c_str(), file.c_str()) == 0;
+}
@@ -0,0 +1,207 @@
+/*
+ * acquisition - RedPitaya Data Acquisition
+ *
+ *
+ * Copyright (C) 2016, 2017 Moritz Kütt, Malte Göttsche, Alexander Glaser
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: moritz@nuclearfreesoftware.org
+ */
+
+
+#include "RealtimeProfile.hh"
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+RealtimeProfile::RealtimeProfile() {
+  settings.enabled = false;
+  settings.core = -1;
+  settings.priority = 0;
+  locked = false;
+  pinned = false;
+  raised = false;
+  CPU_ZERO(&oldset);
+  oldpolicy = SCHED_OTHER;
+  memset(&oldparam, 0, sizeof(oldparam));
+  Prepare();
+}
+
+RealtimeProfile::~RealtimeProfile() {
+}
+
+void RealtimeProfile::SetSettings(const RealtimeSettings & rs) {
+  settings = rs;
+}
+
+void RealtimeProfile::Prepare() {
+  last = 0;
+  count = 0;
+  sum = 0;
+  maximum = 0;
+  memset(buckets, 0, sizeof(buckets));
+  if(!settings.enabled) {
+    return;
+  }
+  if(mlockall(MCL_CURRENT | MCL_FUTURE) == 0) {
+    locked = true;
+  }
+  else {
+    std::cout << "Warning: Could not lock memory (" << strerror(errno) << ", needs root or a higher RLIMIT_MEMLOCK), pages may be swapped" << std::endl;
+  }
+}
+
+void RealtimeProfile::Finish() {
+  if(locked) {
+    // Replaces MCL_FUTURE, the current pages (and the burst memory) stay locked
+    mlockall(MCL_CURRENT);
+  }
+  locked = false;
+}
+
+void RealtimeProfile::Prefault(void * mem, size_t bytes) {
+  // Read and write back one byte per page, contents are kept
+  if(!mem) {
+    return;
+  }
+  volatile char * p = (volatile char *) mem;
+  size_t page = sysconf(_SC_PAGESIZE);
+  for(size_t i = 0; i < bytes; i += page) {
+    p[i] = p[i];
+  }
+  if(bytes > 0) {
+    p[bytes - 1] = p[bytes - 1];
+  }
+}
+
+static void __attribute__((noinline)) PrefaultStack() {
+  volatile char stack[STACKPREFAULT];
+  for(size_t i = 0; i < sizeof(stack); i += 1024) {
+    stack[i] = 0;
+  }
+}
+
+void RealtimeProfile::Enter() {
+  pinned = false;
+  raised = false;
+  if(!settings.enabled) {
+    return;
+  }
+  PrefaultStack();
+  if(settings.core >= 0) {
+    if(settings.core >= (int) std::thread::hardware_concurrency()) {
+      std::cout << "Warning: There is no core " << settings.core << ", acquisition loop not pinned" << std::endl;
+    }
+    else {
+      pthread_getaffinity_np(pthread_self(), sizeof(oldset), &oldset);
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(settings.core, &set);
+      int r = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+      if(r == 0) {
+	pinned = true;
+      }
+      else {
+	std::cout << "Warning: Could not pin acquisition loop to core " << settings.core << ": " << strerror(r) << std::endl;
+      }
+    }
+  }
+  if(settings.priority > 0) {
+    pthread_getschedparam(pthread_self(), &oldpolicy, &oldparam);
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = settings.priority;
+    int r = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if(r == 0) {
+      raised = true;
+    }
+    else {
+      std::cout << "Warning: Could not run acquisition loop with SCHED_FIFO priority " << settings.priority << ": " << strerror(r)
+		<< " (needs root or CAP_SYS_NICE)" << std::endl;
+    }
+  }
+}
+
+void RealtimeProfile::Leave() {
+  if(raised) {
+    pthread_setschedparam(pthread_self(), oldpolicy, &oldparam);
+  }
+  if(pinned) {
+    pthread_setaffinity_np(pthread_self(), sizeof(oldset), &oldset);
+  }
+}
+
+uint64_t RealtimeProfile::GetQuantile(double q) {
+  // Upper edge of the bucket holding the quantile, capped by the maximum
+  if(count == 0) {
+    return 0;
+  }
+  uint64_t rank = (uint64_t) (q * count);
+  uint64_t seen = 0;
+  for(int b = 0; b < JITTERBUCKETS; b++) {
+    seen += buckets[b];
+    if(seen > rank) {
+      uint64_t upper = 2ULL << b;
+      return upper < maximum ? upper : maximum;
+    }
+  }
+  return maximum;
+}
+
+void RealtimeProfile::Print() {
+  printf("Real-time profile: core %d, priority %d, memory %s.\n", pinned ? settings.core : -1,
+	 raised ? settings.priority : 0, locked ? "locked" : "not locked");
+  if(count == 0) {
+    fflush(stdout);
+    return;
+  }
+  printf("Loop jitter: %llu iterations, mean %.3f us, p50 %.3f us, p99 %.3f us, p99.9 %.3f us, max %.3f us.\n",
+	 (unsigned long long) count, GetMean() * 1e-3, GetQuantile(0.5) * 1e-3, GetQuantile(0.99) * 1e-3,
+	 GetQuantile(0.999) * 1e-3, maximum * 1e-3);
+  for(int b = 0; b < JITTERBUCKETS; b++) {
+    if(buckets[b] == 0) {
+      continue;
+    }
+    printf("  %12.3f - %12.3f us %12llu\n", (b == 0 ? 0 : 1ULL << b) * 1e-3, (2ULL << b) * 1e-3, (unsigned long long) buckets[b]);
+  }
+  fflush(stdout);
+}
+
+bool RealtimeProfile::Save(std::string file) {
+  FILE * fh = fopen(file.c_str(), "w");
+  if(!fh) {
+    std::cout << "Error: Could not open " << file << std::endl;
+    return false;
+  }
+  fprintf(fh, "# Loop iteration times, trigger seen until ready for the next\n");
+  fprintf(fh, "# Core:                %d\n", pinned ? settings.core : -1);
+  fprintf(fh, "# SCHED_FIFO priority: %d\n", raised ? settings.priority : 0);
+  fprintf(fh, "# Memory locked:       %s\n", locked ? "yes" : "no");
+  fprintf(fh, "# Iterations:          %llu\n", (unsigned long long) count);
+  fprintf(fh, "# Mean [ns]:           %.1f\n", GetMean());
+  fprintf(fh, "# Max [ns]:            %llu\n", (unsigned long long) maximum);
+  fprintf(fh, "# <lower bucket edge [ns]> <upper bucket edge [ns]> <counts>\n");
+  for(int b = 0; b < JITTERBUCKETS; b++) {
+    fprintf(fh, "%llu %llu %llu\n", b == 0 ? 0ULL : 1ULL << b, 2ULL << b, (unsigned long long) buckets[b]);
+  }
+  fclose(fh);
+  return true;
+}
@@ -0,0 +1,466 @@
+/*
+ * acquisition - RedPitaya Data Acquisition
+ *
+ *
+ * Copyright (C) 2016, 2017 Moritz Kütt, Malte Göttsche, Alexander Glaser
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: moritz@nuclearfreesoftware.org
+ */
+
+
+#include "SimulatedFPGAInterface.hh"
+
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <cstddef>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <limits>
+#include <algorithm>
+#include <iostream>
+
+SimulatedFPGAInterface::SimulatedFPGAInterface(std::string file) {
+  filename = file;
+  fd = -1;
+  memory = NULL;
+  atomicconfig = true;
+
+  // Defaults resemble a NaI detector on a PMT, negative pulses
+  settings.samplerate = ADCSAMPLERATE;
+  settings.pulserate = 1000;
+  settings.amplitude = 2000;
+  settings.amplitudespread = 0.05;
+  settings.risetime = 10;
+  settings.decaytime = 250;
+  settings.noise = 3;
+  settings.baseline = 0;
+  settings.polarity = -1;
+  settings.seed = 12345;
+
+  pulsetemplate = NULL;
+  templatelength = 0;
+  templatedecimation = 0;
+  samplesperpulse = 0;
+
+  running = false;
+  generated = 0;
+  captured = 0;
+  triggers = 0;
+  skipped = 0;
+}
+
+SimulatedFPGAInterface::~SimulatedFPGAInterface() {
+  stopOscilloscope();
+}
+
+int SimulatedFPGAInterface::initOscilloscope() {
+  // Clean up before Opening
+  if(stopOscilloscope() < 0) {
+    return -1;
+  }
+
+  if(filename.empty()) {
+    memory = mmap(NULL, OSCBASESIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  }
+  else {
+    fd = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+    if(fd < 0) {
+      std::cout << "Error opening simulation file " << filename << std::endl;
+      return -1;
+    }
+    if(ftruncate(fd, OSCBASESIZE) < 0) {
+      std::cout << "Error while resizing simulation file, ftruncate() error" << std::endl;
+      std::cout << strerror(errno);
+      stopOscilloscope();
+      return -1;
+    }
+    memory = mmap(NULL, OSCBASESIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+
+  if(memory == MAP_FAILED) {
+    std::cout << "Error while starting simulated oscilloscope, mmap() error" << std::endl;
+    std::cout << strerror(errno);
+    memory = NULL;
+    stopOscilloscope();
+    return -1;
+  }
+
+  memset(memory, 0, OSCBASESIZE);
+  omem = (oscilloscope_mem*) memory;
+  ochA = (uint32_t *)memory + (OSCCHAOFFSET / sizeof(uint32_t));
+  ochB = (uint32_t *)memory + (OSCCHBOFFSET / sizeof(uint32_t));
+  omem->decimation = 1;
+  for(int i = 0; i < SIMBUF; i++) {
+    ochA[i] = settings.baseline & 0x3FFF;
+    ochB[i] = settings.baseline & 0x3FFF;
+  }
+
+  rng = settings.seed ? settings.seed : 1;
+  for(int i = 0; i < (1 << SIMNOISEBITS); i++) {
+    noisetable[i] = settings.noise * Gauss();
+  }
+  noisemax = 0;
+  for(int i = 0; i < 2 * SIMBUF; i++) {
+    noisevalue[i] = (int) std::floor(noisetable[i] + 0.5);
+    noiseblock[i] = (settings.baseline + noisevalue[i]) & 0x3FFF;
+    if(std::abs(noisevalue[i]) > noisemax) {
+      noisemax = std::abs(noisevalue[i]);
+    }
+  }
+  samplecount = 0;
+  triggered = false;
+  wasarmed = false;
+  postcount = 0;
+  lastA = settings.baseline;
+  lastB = settings.baseline;
+  channelA.first = 0;
+  channelA.count = 0;
+  channelB.first = 0;
+  channelB.count = 0;
+  BuildTemplate(1);
+  channelA.nextarrival = -std::log(1 - Uniform()) * samplesperpulse;
+  channelB.nextarrival = -std::log(1 - Uniform()) * samplesperpulse;
+
+  oinit = true;
+  running = true;
+  generator = std::thread(&SimulatedFPGAInterface::Run, this);
+  return 0;
+}
+
+int SimulatedFPGAInterface::stopOscilloscope() {
+  running = false;
+  if(generator.joinable()) {
+    generator.join();
+  }
+  if(memory) {
+    if(munmap(memory, OSCBASESIZE) < 0) {
+      std::cout << "Error while stopping simulated oscilloscope, munmap() error" << std::endl;
+      return -1;
+    }
+  }
+  memory = NULL;
+  omem = NULL;
+  ochA = NULL;
+  ochB = NULL;
+  oinit = false;
+  if(fd > 0) {
+    close(fd);
+    fd = -1;
+  }
+  delete [] pulsetemplate;
+  pulsetemplate = NULL;
+  return 0;
+}
+
+void SimulatedFPGAInterface::DumpStatistics() {
+  std::cout << "*** Simulated Oscilloscope" << std::endl;
+  std::cout << "Generated pulses:         " << generated << std::endl;
+  std::cout << "Pulses while armed:       " << captured << std::endl;
+  std::cout << "Triggers:                 " << triggers << std::endl;
+  if(skipped > 0) {
+    std::cout << "Warning: generator fell behind real time, skipped " << skipped << " samples" << std::endl;
+  }
+}
+
+void SimulatedFPGAInterface::Run() {
+  typedef std::chrono::steady_clock clock_t;
+  clock_t::time_point last = clock_t::now();
+  double due = 0;
+
+  while(running) {
+    uint32_t dec = omem->decimation;
+    if(dec < 1) {
+      dec = 1;
+    }
+    if((int) dec != templatedecimation) {
+      BuildTemplate(dec);
+    }
+
+    // Sample clock follows the wall clock
+    clock_t::time_point now = clock_t::now();
+    due += std::chrono::duration<double>(now - last).count() * settings.samplerate / dec;
+    last = now;
+    if(due < 1) {
+      std::this_thread::sleep_for(std::chrono::microseconds(20));
+      continue;
+    }
+    int64_t n = (int64_t) due;
+    due -= n;
+    if(n > 4 * SIMBUF) {
+      // Too slow to keep up, jump ahead without writing samples
+      skipped += n - SIMBUF;
+      Generate(n - SIMBUF, false);
+      n = SIMBUF;
+    }
+
+    // Atomic, the acquisition sets TRIGGERARMBIT concurrently
+    uint32_t cfg = omem->configuration;
+    if(cfg & OSCRESETBIT) {
+      ClearConfigurationBits(OSCRESETBIT);
+      omem->writepointer = 0;
+      triggered = false;
+    }
+    Generate(n, cfg & TRIGGERARMBIT);
+  }
+}
+
+void SimulatedFPGAInterface::Generate(int64_t n, bool armed) {
+  if(!armed) {
+    // Nothing is written, pulses only have to be kept in the schedule
+    samplecount += n;
+    SchedulePulses(channelA, samplecount, false);
+    SchedulePulses(channelB, samplecount, false);
+    wasarmed = false;
+    return;
+  }
+
+  if(!wasarmed) {
+    // The comparator of the FPGA runs continuously: edges are searched
+    // from the signal level at the arm, not from the end of the last
+    // capture, so a pulse that started in the dead time does not fire
+    lastA = SampleValue(channelA, samplecount - 1, false);
+    lastB = SampleValue(channelB, samplecount - 1, false);
+    wasarmed = true;
+  }
+
+  uint32_t source = omem->trigger;
+  uint32_t wp = omem->writepointer % SIMBUF;
+  int thA = omem->threshold_A & 0x3FFF;
+  int thB = omem->threshold_B & 0x3FFF;
+  if(thA >= 8192) {
+    thA -= 16384;
+  }
+  if(thB >= 8192) {
+    thB -= 16384;
+  }
+
+  // Noise alone can not fire an edge trigger outside of the noise band,
+  // so stretches without pulses are filled from the prepared noise block
+  bool quiet;
+  switch(source) {
+  case 1: quiet = false; break;
+  case 2: quiet = settings.baseline + noisemax < thA; break;
+  case 3: quiet = settings.baseline - noisemax > thA; break;
+  case 4: quiet = settings.baseline + noisemax < thB; break;
+  case 5: quiet = settings.baseline - noisemax > thB; break;
+  default: quiet = true; break;
+  }
+
+  int64_t i = 0;
+  while(i < n) {
+    int64_t t = samplecount;
+    ExpirePulses(channelA, t);
+    ExpirePulses(channelB, t);
+    if((quiet || triggered) && channelA.count == 0 && channelB.count == 0) {
+      int64_t len = n - i;
+      double next = std::min(channelA.nextarrival, channelB.nextarrival);
+      if(next - t < len) {
+        len = (int64_t) std::ceil(next) - t;
+      }
+      if(triggered && len > postcount) {
+        len = postcount;
+      }
+      if(len > SIMBUF - wp) {
+        len = SIMBUF - wp;
+      }
+      if(len > 0) {
+        int offA = rng % SIMBUF;
+        int offB = (rng >> 16) % SIMBUF;
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        memcpy(ochA + wp, noiseblock + offA, len * sizeof(uint32_t));
+        memcpy(ochB + wp, noiseblock + offB, len * sizeof(uint32_t));
+        lastA = settings.baseline + noisevalue[offA + len - 1];
+        lastB = settings.baseline + noisevalue[offB + len - 1];
+        wp = (wp + len) % SIMBUF;
+        samplecount += len;
+        i += len;
+        if(triggered) {
+          postcount -= len;
+          if(postcount == 0) {
+            FinishCapture(wp);
+            Generate(n - i, false);
+            return;
+          }
+        }
+        continue;
+      }
+    }
+
+    samplecount++;
+    i++;
+    int a = SampleValue(channelA, t, true);
+    int b = SampleValue(channelB, t, true);
+    ochA[wp] = a & 0x3FFF;
+    ochB[wp] = b & 0x3FFF;
+
+    bool finished = false;
+    if(triggered) {
+      finished = (postcount == 0 || --postcount == 0);
+    }
+    else if(source != 0) {
+      bool fire = false;
+      switch(source) {
+      case 1: fire = true; break;
+      case 2: fire = (lastA < thA && a >= thA); break;
+      case 3: fire = (lastA > thA && a <= thA); break;
+      case 4: fire = (lastB < thB && b >= thB); break;
+      case 5: fire = (lastB > thB && b <= thB); break;
+      default: break;
+      }
+      if(fire) {
+        triggered = true;
+        triggers++;
+        omem->triggerpointer = wp;
+        postcount = omem->posttriggertracelength;
+        finished = (postcount == 0);
+      }
+    }
+    lastA = a;
+    lastB = b;
+    wp = (wp + 1) % SIMBUF;
+
+    if(finished) {
+      FinishCapture(wp);
+      Generate(n - i, false);
+      return;
+    }
+  }
+  omem->writepointer = wp;
+}
+
+void SimulatedFPGAInterface::FinishCapture(uint32_t wp) {
+  // Capture complete: publish samples before the trigger register
+  // signals it, then stop writing until re-armed
+  omem->writepointer = wp;
+  std::atomic_thread_fence(std::memory_order_release);
+  ClearConfigurationBits(TRIGGERARMBIT);
+  omem->trigger = 0;
+  triggered = false;
+  wasarmed = false;
+}
+
+inline void SimulatedFPGAInterface::ExpirePulses(PulseChannel & ch, int64_t t) {
+  while(ch.count > 0 && t - ch.pulses[ch.first].start >= templatelength) {
+    ch.first = (ch.first + 1) % SIMMAXPULSES;
+    ch.count--;
+  }
+}
+
+inline int SimulatedFPGAInterface::SampleValue(PulseChannel & ch, int64_t t, bool armed) {
+  if(ch.nextarrival < t + 1) {
+    SchedulePulses(ch, t + 1, armed);
+  }
+
+  double value = 0;
+  ExpirePulses(ch, t);
+  for(int k = 0; k < ch.count; k++) {
+    const Pulse & p = ch.pulses[(ch.first + k) % SIMMAXPULSES];
+    if(p.start > t) {
+      // Arrives between t and t + 1, starts with the next sample
+      break;
+    }
+    value += p.amplitude * pulsetemplate[t - p.start];
+  }
+
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  value = settings.polarity * value + noisetable[rng >> (32 - SIMNOISEBITS)];
+  int v = settings.baseline + (int) std::floor(value + 0.5);
+  if(v > 8191) {
+    v = 8191;
+  }
+  else if(v < -8192) {
+    v = -8192;
+  }
+  return v;
+}
+
+void SimulatedFPGAInterface::SchedulePulses(PulseChannel & ch, int64_t t, bool armed) {
+  while(ch.nextarrival < t) {
+    int slot;
+    if(ch.count < SIMMAXPULSES) {
+      slot = (ch.first + ch.count) % SIMMAXPULSES;
+      ch.count++;
+    }
+    else {
+      // Drop the oldest pulse, it has decayed by now
+      slot = ch.first;
+      ch.first = (ch.first + 1) % SIMMAXPULSES;
+    }
+    ch.pulses[slot].start = (int64_t) std::ceil(ch.nextarrival);
+    ch.pulses[slot].amplitude = settings.amplitude * (1 + settings.amplitudespread * Gauss());
+    // Counted on channel A only, both channels get the same rate
+    if(&ch == &channelA) {
+      generated++;
+      if(armed) {
+	captured++;
+      }
+    }
+    ch.nextarrival += -std::log(1 - Uniform()) * samplesperpulse;
+  }
+}
+
+void SimulatedFPGAInterface::BuildTemplate(int decimation) {
+  double rate = settings.samplerate / decimation;
+  double dt = 1e9 / rate; // ns per sample
+  double rise = settings.risetime > 0 ? settings.risetime : 1e-3;
+  double decay = settings.decaytime > rise ? settings.decaytime : rise * 1.01;
+
+  // Normalize to unit peak height
+  double tpeak = rise * decay / (decay - rise) * std::log(decay / rise);
+  double norm = std::exp(-tpeak / decay) - std::exp(-tpeak / rise);
+
+  int len = (int) std::ceil((tpeak + 8 * decay) / dt) + 1;
+  if(len > SIMBUF) {
+    len = SIMBUF;
+  }
+  delete [] pulsetemplate;
+  pulsetemplate = new float[len];
+  for(int i = 0; i < len; i++) {
+    double t = i * dt;
+    pulsetemplate[i] = (std::exp(-t / decay) - std::exp(-t / rise)) / norm;
+  }
+  templatelength = len;
+  templatedecimation = decimation;
+
+  if(settings.pulserate > 0) {
+    samplesperpulse = rate / settings.pulserate;
+  }
+  else {
+    samplesperpulse = std::numeric_limits<double>::infinity();
+  }
+}
+
+double SimulatedFPGAInterface::Uniform() {
+  // xorshift32
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng * (1.0 / 4294967296.0);
+}
+
+double SimulatedFPGAInterface::Gauss() {
+  // Irwin-Hall approximation, good enough for detector noise
+  return (Uniform() + Uniform() + Uniform() + Uniform() - 2.0) * 1.7320508075688772;
+}
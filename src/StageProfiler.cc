@@ -0,0 +1,126 @@
+/*
+ * acquisition - RedPitaya Data Acquisition
+ *
+ *
+ * Copyright (C) 2016, 2017 Moritz Kütt, Malte Göttsche, Alexander Glaser
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: moritz@nuclearfreesoftware.org
+ */
+
+
+#include "StageProfiler.hh"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+StageProfiler::StageProfiler() {
+  Reset();
+}
+
+StageProfiler::~StageProfiler() {
+}
+
+void StageProfiler::Reset() {
+  last = 0;
+  memset(counts, 0, sizeof(counts));
+  memset(sums, 0, sizeof(sums));
+  memset(maxima, 0, sizeof(maxima));
+  memset(buckets, 0, sizeof(buckets));
+}
+
+void StageProfiler::Merge(const StageProfiler & p) {
+  for(int s = 0; s < STAGE_COUNT; s++) {
+    counts[s] += p.counts[s];
+    sums[s] += p.sums[s];
+    if(p.maxima[s] > maxima[s]) {
+      maxima[s] = p.maxima[s];
+    }
+    for(int b = 0; b < PROFILEBUCKETS; b++) {
+      buckets[s][b] += p.buckets[s][b];
+    }
+  }
+}
+
+const char * StageProfiler::StageName(int stage) {
+  static const char * names[STAGE_COUNT] = {
+    "arm", "wait", "search", "copy", "integrate", "reject", "format", "write"
+  };
+  return (stage >= 0 && stage < STAGE_COUNT) ? names[stage] : "unknown";
+}
+
+uint64_t StageProfiler::GetQuantile(int stage, double q) {
+  // Upper edge of the bucket holding the quantile, capped by the maximum
+  if(counts[stage] == 0) {
+    return 0;
+  }
+  uint64_t rank = (uint64_t) (q * counts[stage]);
+  uint64_t seen = 0;
+  for(int b = 0; b < PROFILEBUCKETS; b++) {
+    seen += buckets[stage][b];
+    if(seen > rank) {
+      uint64_t upper = 2ULL << b;
+      return upper < maxima[stage] ? upper : maxima[stage];
+    }
+  }
+  return maxima[stage];
+}
+
+void StageProfiler::Print() {
+  printf("Stage latencies [us] (quantiles are upper bucket edges):\n");
+  printf("%-10s %12s %10s %10s %10s %10s\n", "stage", "count", "mean", "p50", "p99", "max");
+  for(int s = 0; s < STAGE_COUNT; s++) {
+    if(counts[s] == 0) {
+      continue;
+    }
+    printf("%-10s %12llu %10.3f %10.3f %10.3f %10.3f\n", StageName(s), (unsigned long long) counts[s],
+	   GetMean(s) * 1e-3, GetQuantile(s, 0.5) * 1e-3, GetQuantile(s, 0.99) * 1e-3, maxima[s] * 1e-3);
+  }
+  fflush(stdout);
+}
+
+bool StageProfiler::SaveJSON(std::string file, std::string run) {
+  FILE * fh = fopen(file.c_str(), "w");
+  if(!fh) {
+    std::cout << "Error: Could not open " << file << std::endl;
+    return false;
+  }
+  fprintf(fh, "{\n  \"run\": \"%s\",\n  \"unit\": \"ns\",\n  \"stages\": [", run.c_str());
+  bool first = true;
+  for(int s = 0; s < STAGE_COUNT; s++) {
+    if(counts[s] == 0) {
+      continue;
+    }
+    fprintf(fh, "%s\n    {\"name\": \"%s\", \"count\": %llu, \"sum\": %llu, \"mean\": %.1f, \"max\": %llu, \"p50\": %llu, \"p99\": %llu,\n",
+	    first ? "" : ",", StageName(s), (unsigned long long) counts[s], (unsigned long long) sums[s], GetMean(s),
+	    (unsigned long long) maxima[s], (unsigned long long) GetQuantile(s, 0.5), (unsigned long long) GetQuantile(s, 0.99));
+    // Non empty buckets as [lower edge, count]
+    fprintf(fh, "     \"buckets\": [");
+    bool firstbucket = true;
+    for(int b = 0; b < PROFILEBUCKETS; b++) {
+      if(buckets[s][b] == 0) {
+	continue;
+      }
+      fprintf(fh, "%s[%llu, %llu]", firstbucket ? "" : ", ", b == 0 ? 0ULL : 1ULL << b, (unsigned long long) buckets[s][b]);
+      firstbucket = false;
+    }
+    fprintf(fh, "]}");
+    first = false;
+  }
+  fprintf(fh, "\n  ]\n}\n");
+  fclose(fh);
+  return true;
+}
@@ -0,0 +1,124 @@
+/*
+ * acquisition - RedPitaya Data Acquisition
+ *
+ *
+ * Copyright (C) 2016, 2017 Moritz Kütt, Malte Göttsche, Alexander Glaser
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: moritz@nuclearfreesoftware.org
+ */
+
+
+#include "TextFormat.hh"
+#include "TraceKernels.hh"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+static const char digitpairs[201] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+/** Write v with at least mindigits digits (zero padded) */
+static char * FormatUnsigned(char * p, uint64_t v, int mindigits) {
+  char tmp[24];
+  char * t = tmp + sizeof(tmp);
+  while(v >= 100) {
+    int r = v % 100;
+    v /= 100;
+    t -= 2;
+    memcpy(t, digitpairs + 2 * r, 2);
+  }
+  if(v >= 10) {
+    t -= 2;
+    memcpy(t, digitpairs + 2 * v, 2);
+  }
+  else {
+    *--t = '0' + v;
+  }
+  while(tmp + sizeof(tmp) - t < mindigits) {
+    *--t = '0';
+  }
+  int len = tmp + sizeof(tmp) - t;
+  memcpy(p, t, len);
+  return p + len;
+}
+
+char * FormatInt(char * p, int v) {
+  uint32_t u = v;
+  if(v < 0) {
+    *p++ = '-';
+    u = 0u - u;
+  }
+  return FormatUnsigned(p, u, 1);
+}
+
+char * FormatFixed(char * p, double v) {
+  // Up to 2^43 the scaled fraction has an error far below 1e-3
+  double a = fabs(v);
+  if(!(a < 8.796093022208e12)) {
+    return p + snprintf(p, MAXTEXTFIXED, "%f", v);
+  }
+  double ip = floor(a);
+  double scaled = (a - ip) * 1e6;
+  double rounded = floor(scaled + 0.5);
+  // Close to a tie the exact decimal value of v decides, leave it to printf
+  if(fabs(scaled - rounded) > 0.499) {
+    return p + snprintf(p, MAXTEXTFIXED, "%f", v);
+  }
+  uint64_t whole = (uint64_t) ip;
+  uint32_t frac = (uint32_t) rounded;
+  if(frac >= 1000000) {
+    frac -= 1000000;
+    whole++;
+  }
+  if(std::signbit(v)) {
+    *p++ = '-';
+  }
+  p = FormatUnsigned(p, whole, 1);
+  *p++ = '.';
+  return FormatUnsigned(p, frac, 6);
+}
+
+int FormatTrace(const int16_t * trace, int n, char * out) {
+  char * p = out;
+  for(int i = 0; i < n; i++) {
+    // Raw samples are 0..16383, at most 5 digits
+    uint32_t v = RawSample(trace[i]);
+    if(v >= 10000) {
+      uint32_t hi = v / 10000;
+      uint32_t lo = v - hi * 10000;
+      *p++ = '0' + hi;
+      memcpy(p, digitpairs + 2 * (lo / 100), 2);
+      memcpy(p + 2, digitpairs + 2 * (lo % 100), 2);
+      p += 4;
+    }
+    else {
+      p = FormatUnsigned(p, v, 1);
+    }
+    *p++ = ' ';
+  }
+  *p++ = '\n';
+  return p - out;
+}
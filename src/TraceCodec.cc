@@ -0,0 +1,64 @@
+/*
+ * acquisition - RedPitaya Data Acquisition
+ *
+ *
+ * Copyright (C) 2016, 2017 Moritz Kütt, Malte Göttsche, Alexander Glaser
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: moritz@nuclearfreesoftware.org
+ */
+
+
+#include "TraceCodec.hh"
+
+int EncodeTrace(const int16_t * trace, int n, uint8_t * out) {
+  uint8_t * p = out;
+  int32_t last = 0;
+  for(int i = 0; i < n; i++) {
+    int32_t d = trace[i] - last;
+    last = trace[i];
+    uint32_t z = ((uint32_t) d << 1) ^ (uint32_t) (d >> 31);
+    while(z >= 0x80) {
+      *p++ = (uint8_t) (z | 0x80);
+      z >>= 7;
+    }
+    *p++ = (uint8_t) z;
+  }
+  return p - out;
+}
+
+int DecodeTrace(const uint8_t * in, int avail, int n, int16_t * out) {
+  const uint8_t * p = in;
+  const uint8_t * end = in + avail;
+  int32_t last = 0;
+  for(int i = 0; i < n; i++) {
+    uint32_t z = 0;
+    int shift = 0;
+    while(true) {
+      if(p == end || shift > 14) {
+	return -1;
+      }
+      uint8_t b = *p++;
+      z |= (uint32_t) (b & 0x7f) << shift;
+      if(!(b & 0x80)) {
+	break;
+      }
+      shift += 7;
+    }
+    last += (int32_t) (z >> 1) ^ -(int32_t) (z & 1);
+    out[i] = (int16_t) last;
+  }
+  return p - in;
+}
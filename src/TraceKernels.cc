@@ -0,0 +1,398 @@
+/*
+ * acquisition - RedPitaya Data Acquisition
+ *
+ *
+ * Copyright (C) 2016, 2017 Moritz Kütt, Malte Göttsche, Alexander Glaser
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: moritz@nuclearfreesoftware.org
+ */
+
+
+#include "TraceKernels.hh"
+
+#include <cstdlib>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define TRACEKERNELS_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define TRACEKERNELS_SSE2
+#endif
+
+void SubtractBaseline(const TraceIntegral & ti, int n, int baselinelength, double & total, int & peak) {
+  double baseline = ti.baseline;
+  total = ti.total;
+  peak = ti.peak;
+  total -= n * baseline / baselinelength;
+  // Integer abs, as the acquisition always did
+  peak -= abs((int) (baseline / baselinelength));
+}
+
+bool AcceptPulse(double total, int peak, float ratiomin, float ratiomax, float curvebend) {
+  int magnitude = abs((int) total);
+  if(magnitude >= peak * ratiomin and magnitude <= peak * ratiomax) {
+    return true;
+  }
+  else if(peak <= curvebend and magnitude <= peak * ratiomax) {
+    return true;
+  }
+  return false;
+}
+
+void ExtractTrace(const uint32_t * ring, int ringsize, int start, int n, int16_t * dest) {
+  if(start + n <= ringsize) {
+    ExtractSpan(ring + start, n, dest);
+  }
+  else {
+    int first = ringsize - start;
+    ExtractSpan(ring + start, first, dest);
+    ExtractSpan(ring, n - first, dest + first);
+  }
+}
+
+void ExtractSpanScalar(const uint32_t * src, int n, int16_t * dest) {
+  for(int i = 0; i < n; i++) {
+    dest[i] = SignedSample(src[i]);
+  }
+}
+
+void IntegrateTraceScalar(const int16_t * trace, int n, int baselinelength,
+			  int peakstart, int peakend, TraceIntegral & res) {
+  int32_t baseline = 0;
+  int32_t total = 0;
+  int32_t peak = 0;
+  int32_t peakpos = 0;
+  for (int i=0; i < n; i++) {
+    int32_t signal = trace[i];
+    if(i < baselinelength) {
+      baseline += signal;
+    }
+    if(i >= peakstart && i <= peakend && abs(signal) > peak) {
+      peak = abs(signal);
+      peakpos = i;
+    }
+    total += signal;
+  }
+  res.baseline = baseline;
+  res.total = total;
+  res.peak = peak;
+  res.peakpos = peakpos;
+}
+
+int FindCrossingScalar(const uint32_t * src, int n, int threshold, bool rising, bool & beyond) {
+  for(int i = 0; i < n; i++) {
+    int32_t v = SignedSample(src[i]);
+    bool b = rising ? v >= threshold : v <= threshold;
+    if(b && !beyond) {
+      beyond = true;
+      return i;
+    }
+    beyond = b;
+  }
+  return -1;
+}
+
+int FindCrossingScalar(const int16_t * src, int n, int threshold, bool rising, bool & beyond) {
+  for(int i = 0; i < n; i++) {
+    int32_t v = src[i];
+    bool b = rising ? v >= threshold : v <= threshold;
+    if(b && !beyond) {
+      beyond = true;
+      return i;
+    }
+    beyond = b;
+  }
+  return -1;
+}
+
+#if defined(TRACEKERNELS_NEON)
+
+void ExtractSpan(const uint32_t * src, int n, int16_t * dest) {
+  int i = 0;
+  // 16 words per iteration, the loads become bursts on the AXI bus
+  for(; i + 16 <= n; i += 16) {
+    int32x4_t a = vreinterpretq_s32_u32(vld1q_u32(src + i));
+    int32x4_t b = vreinterpretq_s32_u32(vld1q_u32(src + i + 4));
+    int32x4_t c = vreinterpretq_s32_u32(vld1q_u32(src + i + 8));
+    int32x4_t d = vreinterpretq_s32_u32(vld1q_u32(src + i + 12));
+    a = vshrq_n_s32(vshlq_n_s32(a, 32 - ADCBITS), 32 - ADCBITS);
+    b = vshrq_n_s32(vshlq_n_s32(b, 32 - ADCBITS), 32 - ADCBITS);
+    c = vshrq_n_s32(vshlq_n_s32(c, 32 - ADCBITS), 32 - ADCBITS);
+    d = vshrq_n_s32(vshlq_n_s32(d, 32 - ADCBITS), 32 - ADCBITS);
+    vst1q_s16(dest + i, vcombine_s16(vmovn_s32(a), vmovn_s32(b)));
+    vst1q_s16(dest + i + 8, vcombine_s16(vmovn_s32(c), vmovn_s32(d)));
+  }
+  ExtractSpanScalar(src + i, n - i, dest + i);
+}
+
+// Sum of samples in [start, end)
+static inline int32_t SumSpan(const int16_t * trace, int start, int end) {
+  int32x4_t acc = vdupq_n_s32(0);
+  int i = start;
+  for(; i + 8 <= end; i += 8) {
+    acc = vpadalq_s16(acc, vld1q_s16(trace + i));
+  }
+  int32x2_t s = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+  int32_t sum = vget_lane_s32(vpadd_s32(s, s), 0);
+  for(; i < end; i++) {
+    sum += trace[i];
+  }
+  return sum;
+}
+
+// Sum and largest absolute value of samples in [start, end)
+static inline int32_t SumMaxSpan(const int16_t * trace, int start, int end, int32_t & peak) {
+  int32x4_t acc = vdupq_n_s32(0);
+  int16x8_t mx = vdupq_n_s16(0);
+  int i = start;
+  for(; i + 8 <= end; i += 8) {
+    int16x8_t v = vld1q_s16(trace + i);
+    acc = vpadalq_s16(acc, v);
+    mx = vmaxq_s16(mx, vabsq_s16(v));
+  }
+  int32x2_t s = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+  int32_t sum = vget_lane_s32(vpadd_s32(s, s), 0);
+  int16x4_t m = vmax_s16(vget_low_s16(mx), vget_high_s16(mx));
+  m = vpmax_s16(m, m);
+  m = vpmax_s16(m, m);
+  int32_t p = vget_lane_s16(m, 0);
+  for(; i < end; i++) {
+    if(abs(trace[i]) > p) {
+      p = abs(trace[i]);
+    }
+    sum += trace[i];
+  }
+  peak = p;
+  return sum;
+}
+
+// 0 if none of 16 samples is beyond the threshold, 0xFFFF if all are
+static inline uint32_t BeyondMask(const uint32_t * src, int threshold, bool rising) {
+  int32x4_t th = vdupq_n_s32(threshold);
+  uint32x4_t m[4];
+  for(int k = 0; k < 4; k++) {
+    int32x4_t v = vreinterpretq_s32_u32(vld1q_u32(src + 4 * k));
+    v = vshrq_n_s32(vshlq_n_s32(v, 32 - ADCBITS), 32 - ADCBITS);
+    m[k] = rising ? vcgeq_s32(v, th) : vcleq_s32(v, th);
+  }
+  uint8x8_t lo = vmovn_u16(vcombine_u16(vmovn_u32(m[0]), vmovn_u32(m[1])));
+  uint8x8_t hi = vmovn_u16(vcombine_u16(vmovn_u32(m[2]), vmovn_u32(m[3])));
+  uint64_t l = vget_lane_u64(vreinterpret_u64_u8(lo), 0);
+  uint64_t h = vget_lane_u64(vreinterpret_u64_u8(hi), 0);
+  if(l == 0 && h == 0) {
+    return 0;
+  }
+  if(l == ~(uint64_t) 0 && h == ~(uint64_t) 0) {
+    return 0xFFFF;
+  }
+  return 1;
+}
+
+static inline uint32_t BeyondMask(const int16_t * src, int threshold, bool rising) {
+  int16x8_t th = vdupq_n_s16(threshold);
+  int16x8_t a = vld1q_s16(src);
+  int16x8_t b = vld1q_s16(src + 8);
+  uint16x8_t ma = rising ? vcgeq_s16(a, th) : vcleq_s16(a, th);
+  uint16x8_t mb = rising ? vcgeq_s16(b, th) : vcleq_s16(b, th);
+  uint64_t l = vget_lane_u64(vreinterpret_u64_u8(vmovn_u16(ma)), 0);
+  uint64_t h = vget_lane_u64(vreinterpret_u64_u8(vmovn_u16(mb)), 0);
+  if(l == 0 && h == 0) {
+    return 0;
+  }
+  if(l == ~(uint64_t) 0 && h == ~(uint64_t) 0) {
+    return 0xFFFF;
+  }
+  return 1;
+}
+
+#elif defined(TRACEKERNELS_SSE2)
+
+static inline __m128i SignExtend(__m128i v) {
+  return _mm_srai_epi32(_mm_slli_epi32(v, 32 - ADCBITS), 32 - ADCBITS);
+}
+
+static inline int32_t HorizontalSum(__m128i v) {
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(v);
+}
+
+void ExtractSpan(const uint32_t * src, int n, int16_t * dest) {
+  int i = 0;
+  for(; i + 16 <= n; i += 16) {
+    __m128i a = SignExtend(_mm_loadu_si128((const __m128i *) (src + i)));
+    __m128i b = SignExtend(_mm_loadu_si128((const __m128i *) (src + i + 4)));
+    __m128i c = SignExtend(_mm_loadu_si128((const __m128i *) (src + i + 8)));
+    __m128i d = SignExtend(_mm_loadu_si128((const __m128i *) (src + i + 12)));
+    _mm_storeu_si128((__m128i *) (dest + i), _mm_packs_epi32(a, b));
+    _mm_storeu_si128((__m128i *) (dest + i + 8), _mm_packs_epi32(c, d));
+  }
+  ExtractSpanScalar(src + i, n - i, dest + i);
+}
+
+// Sum of samples in [start, end)
+static inline int32_t SumSpan(const int16_t * trace, int start, int end) {
+  __m128i acc = _mm_setzero_si128();
+  __m128i ones = _mm_set1_epi16(1);
+  int i = start;
+  for(; i + 8 <= end; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (trace + i));
+    acc = _mm_add_epi32(acc, _mm_madd_epi16(v, ones));
+  }
+  int32_t sum = HorizontalSum(acc);
+  for(; i < end; i++) {
+    sum += trace[i];
+  }
+  return sum;
+}
+
+// Sum and largest absolute value of samples in [start, end), abs(x) is
+// max(x, -x) since SSE2 has no 16-bit abs
+static inline int32_t SumMaxSpan(const int16_t * trace, int start, int end, int32_t & peak) {
+  __m128i acc = _mm_setzero_si128();
+  __m128i mx = _mm_setzero_si128();
+  __m128i zero = _mm_setzero_si128();
+  __m128i ones = _mm_set1_epi16(1);
+  int i = start;
+  for(; i + 8 <= end; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (trace + i));
+    acc = _mm_add_epi32(acc, _mm_madd_epi16(v, ones));
+    mx = _mm_max_epi16(mx, _mm_max_epi16(v, _mm_sub_epi16(zero, v)));
+  }
+  int32_t sum = HorizontalSum(acc);
+  mx = _mm_max_epi16(mx, _mm_shuffle_epi32(mx, _MM_SHUFFLE(1, 0, 3, 2)));
+  mx = _mm_max_epi16(mx, _mm_shuffle_epi32(mx, _MM_SHUFFLE(2, 3, 0, 1)));
+  mx = _mm_max_epi16(mx, _mm_shufflelo_epi16(mx, _MM_SHUFFLE(2, 3, 0, 1)));
+  int32_t p = (int16_t) _mm_cvtsi128_si32(mx);
+  for(; i < end; i++) {
+    if(abs(trace[i]) > p) {
+      p = abs(trace[i]);
+    }
+    sum += trace[i];
+  }
+  peak = p;
+  return sum;
+}
+
+// Bit mask (one bit per sample) of 16 samples beyond the threshold
+static inline uint32_t BeyondMask(const uint32_t * src, int threshold, bool rising) {
+  __m128i th = _mm_set1_epi32(threshold);
+  __m128i m[4];
+  for(int k = 0; k < 4; k++) {
+    __m128i v = SignExtend(_mm_loadu_si128((const __m128i *) (src + 4 * k)));
+    // v >= th is not (th > v), v <= th is not (v > th)
+    m[k] = rising ? _mm_cmpgt_epi32(th, v) : _mm_cmpgt_epi32(v, th);
+  }
+  __m128i p = _mm_packs_epi16(_mm_packs_epi32(m[0], m[1]), _mm_packs_epi32(m[2], m[3]));
+  return ~_mm_movemask_epi8(p) & 0xFFFF;
+}
+
+static inline uint32_t BeyondMask(const int16_t * src, int threshold, bool rising) {
+  __m128i th = _mm_set1_epi16(threshold);
+  __m128i a = _mm_loadu_si128((const __m128i *) src);
+  __m128i b = _mm_loadu_si128((const __m128i *) (src + 8));
+  __m128i ma = rising ? _mm_cmpgt_epi16(th, a) : _mm_cmpgt_epi16(a, th);
+  __m128i mb = rising ? _mm_cmpgt_epi16(th, b) : _mm_cmpgt_epi16(b, th);
+  return ~_mm_movemask_epi8(_mm_packs_epi16(ma, mb)) & 0xFFFF;
+}
+
+#else
+
+void ExtractSpan(const uint32_t * src, int n, int16_t * dest) {
+  ExtractSpanScalar(src, n, dest);
+}
+
+#endif
+
+#if defined(TRACEKERNELS_NEON) || defined(TRACEKERNELS_SSE2)
+
+// Common loop of the wide FindCrossing() versions: blocks of 16 samples
+// where BeyondMask() gives none or all (and no change) are skipped
+template <typename T>
+static inline int FindCrossingBlocks(const T * src, int n, int threshold, bool rising, bool & beyond) {
+  int i = 0;
+  for(; i + 16 <= n; i += 16) {
+    uint32_t m = BeyondMask(src + i, threshold, rising);
+    if(m == 0) {
+      beyond = false;
+      continue;
+    }
+    if(m == 0xFFFF && beyond) {
+      continue;
+    }
+    int r = FindCrossingScalar(src + i, 16, threshold, rising, beyond);
+    if(r >= 0) {
+      return i + r;
+    }
+  }
+  int r = FindCrossingScalar(src + i, n - i, threshold, rising, beyond);
+  return r >= 0 ? i + r : -1;
+}
+
+int FindCrossing(const uint32_t * src, int n, int threshold, bool rising, bool & beyond) {
+  return FindCrossingBlocks(src, n, threshold, rising, beyond);
+}
+
+int FindCrossing(const int16_t * src, int n, int threshold, bool rising, bool & beyond) {
+  return FindCrossingBlocks(src, n, threshold, rising, beyond);
+}
+
+#else
+
+int FindCrossing(const uint32_t * src, int n, int threshold, bool rising, bool & beyond) {
+  return FindCrossingScalar(src, n, threshold, rising, beyond);
+}
+
+int FindCrossing(const int16_t * src, int n, int threshold, bool rising, bool & beyond) {
+  return FindCrossingScalar(src, n, threshold, rising, beyond);
+}
+
+#endif
+
+void IntegrateTrace(const int16_t * trace, int n, int baselinelength,
+		    int peakstart, int peakend, TraceIntegral & res) {
+#if defined(TRACEKERNELS_NEON) || defined(TRACEKERNELS_SSE2)
+  // Split the trace at the peak window, so that every sample is loaded
+  // once: sums everywhere, maximum only inside the window
+  int ws = peakstart < 0 ? 0 : peakstart;
+  int we = peakend + 1 > n ? n : peakend + 1;
+  if(we < ws) {
+    we = ws = n;
+  }
+  int bl = baselinelength > n ? n : baselinelength;
+
+  int32_t peak = 0;
+  int32_t total = SumSpan(trace, 0, ws);
+  total += SumMaxSpan(trace, ws, we, peak);
+  total += SumSpan(trace, we, n);
+
+  res.baseline = SumSpan(trace, 0, bl);
+  res.total = total;
+  res.peak = peak;
+  res.peakpos = 0;
+  if(peak > 0) {
+    for(int i = ws; i < we; i++) {
+      if(abs(trace[i]) == peak) {
+	res.peakpos = i;
+	break;
+      }
+    }
+  }
+#else
+  IntegrateTraceScalar(trace, n, baselinelength, peakstart, peakend, res);
+#endif
+}
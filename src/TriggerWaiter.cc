@@ -0,0 +1,163 @@
+/*
+ * acquisition - RedPitaya Data Acquisition
+ *
+ *
+ * Copyright (C) 2016, 2017 Moritz Kütt, Malte Göttsche, Alexander Glaser
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: moritz@nuclearfreesoftware.org
+ */
+
+
+#include "TriggerWaiter.hh"
+
+#include <sched.h>
+#include <cstdio>
+#include <iostream>
+
+TriggerWaiter::TriggerWaiter() {
+  settings.strategy = WAIT_SPIN;
+  settings.spinpolls = 1000;
+  settings.minsleep = 1000;
+  settings.maxsleep = 1000000;
+  settings.timeout = 10;
+  strategy = WAIT_SPIN;
+  iface = NULL;
+  Prepare(NULL);
+}
+
+TriggerWaiter::~TriggerWaiter() {
+}
+
+void TriggerWaiter::SetSettings(const WaitSettings & ws) {
+  settings = ws;
+  strategy = ws.strategy;
+}
+
+void TriggerWaiter::Prepare(FPGAInterface * fi) {
+  iface = fi;
+  strategy = settings.strategy;
+  if(strategy == WAIT_INTERRUPT && (!iface || !iface->HasInterrupt())) {
+    std::cout << "No trigger interrupt available, waiting with " << StrategyName(WAIT_SLEEP) << " instead" << std::endl;
+    strategy = WAIT_SLEEP;
+  }
+  waits = 0;
+  spinwakes = 0;
+  slowwakes = 0;
+  timeouts = 0;
+  waitedns = 0;
+  cpuns = 0;
+  latencysum = 0;
+  latencymax = 0;
+}
+
+inline bool TriggerWaiter::Round(volatile oscilloscope_mem * mem, uint64_t & sleep, uint64_t remaining) {
+  // One round of the slow phase, true if the trigger was seen
+  switch(strategy) {
+  case WAIT_SPIN:
+    for(int i = 0; i < WAITCHECKPOLLS; i++) {
+      if(mem->trigger == 0) {
+	return true;
+      }
+    }
+    return false;
+  case WAIT_YIELD:
+    sched_yield();
+    break;
+  case WAIT_SLEEP: {
+    struct timespec ts;
+    ts.tv_sec = sleep / 1000000000ULL;
+    ts.tv_nsec = sleep % 1000000000ULL;
+    nanosleep(&ts, NULL);
+    sleep = sleep * 2 < (uint64_t) settings.maxsleep ? sleep * 2 : settings.maxsleep;
+    break;
+  }
+  case WAIT_INTERRUPT: {
+    // Unmasked before the register is read, so a trigger in between
+    // still wakes the poll
+    iface->EnableInterrupt();
+    if(mem->trigger == 0) {
+      return true;
+    }
+    uint64_t ms = remaining / 1000000 + 1;
+    iface->WaitInterrupt(ms < 100 ? ms : 100);
+    break;
+  }
+  }
+  return mem->trigger == 0;
+}
+
+bool TriggerWaiter::Wait(volatile oscilloscope_mem * mem) {
+  waits++;
+  int spin = strategy == WAIT_SPIN ? WAITCHECKPOLLS : settings.spinpolls;
+  for(int i = 0; i < spin; i++) {
+    if(mem->trigger == 0) {
+      spinwakes++;
+      return true;
+    }
+  }
+
+  // Slow phase, clock reads once per round
+  uint64_t begin = Now(CLOCK_MONOTONIC);
+  uint64_t cpubegin = Now(CLOCK_THREAD_CPUTIME_ID);
+  uint64_t timeout = settings.timeout > 0 ? (uint64_t) (settings.timeout * 1e9) : 0;
+  uint64_t sleep = settings.minsleep > 0 ? settings.minsleep : 1;
+  uint64_t last = begin;
+  uint64_t now = begin;
+  bool triggered = false;
+  while(true) {
+    triggered = Round(mem, sleep, timeout > 0 ? timeout - (last - begin) : 1000000000ULL);
+    now = Now(CLOCK_MONOTONIC);
+    if(triggered) {
+      uint64_t latency = now - last;
+      latencysum += latency;
+      if(latency > latencymax) {
+	latencymax = latency;
+      }
+      slowwakes++;
+      break;
+    }
+    if(timeout > 0 && now - begin >= timeout) {
+      timeouts++;
+      break;
+    }
+    last = now;
+  }
+  waitedns += now - begin;
+  cpuns += Now(CLOCK_THREAD_CPUTIME_ID) - cpubegin;
+  return triggered;
+}
+
+void TriggerWaiter::Print() {
+  int spin = strategy == WAIT_SPIN ? WAITCHECKPOLLS : settings.spinpolls;
+  std::cout << "Trigger wait (" << StrategyName(strategy) << "): " << waits << " waits, " << spinwakes << " within "
+	    << spin << " polls, " << slowwakes << " later, " << timeouts << " timeouts." << std::endl;
+  if(slowwakes + timeouts > 0) {
+    char line[200];
+    snprintf(line, sizeof(line), "Waited %.3f s after the first polls, CPU %.3f s (%.1f %%), wake-up latency mean %.1f us, max %.1f us.",
+	     waitedns * 1e-9, cpuns * 1e-9, waitedns > 0 ? 100.0 * cpuns / waitedns : 0, GetMeanLatency() * 1e-3, latencymax * 1e-3);
+    std::cout << line << std::endl;
+  }
+}
+
+const char * TriggerWaiter::StrategyName(WaitStrategy ws) {
+  switch(ws) {
+  case WAIT_SPIN: return "spin";
+  case WAIT_YIELD: return "spin, then yield";
+  case WAIT_SLEEP: return "spin, then sleep";
+  case WAIT_INTERRUPT: return "spin, then interrupt";
+  }
+  return "unknown";
+}
@@ -23,6 +23,23 @@
 
 #include "TriggeredAcquisition.hh"
 
+#include <cstdio>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <pthread.h>
+#include <sched.h>
+
+/** Pin the calling thread to core, ignored if the core does not exist */
+static void PinCurrentThread(int core) {
+  if(core < 0 || core >= (int) std::thread::hardware_concurrency()) {
+    return;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(core, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
 
 TriggeredAcquisition::TriggeredAcquisition() {
   decimation = 1;
@@ -33,6 +50,33 @@ TriggeredAcquisition::TriggeredAcquisition() {
   triggervoltage = 1.0;
 
   writeoff = WRITE_OFF_ASCII_SINGLE;
+  acquisition = ACQ_DIRECT;
+  writeofffn = &TriggeredAcquisition::WriteOffEvent<WRITE_OFF_ASCII_SINGLE, 0>;
+  peakstart = 0;
+  peakend = 0;
+  channel = CHANNEL_A;
+  channelfn = writeofffn;
+  measuresrc[0] = NULL;
+  measuresrc[1] = NULL;
+  nchannels = 1;
+  channelstride = 0;
+  channelslot = 0;
+  channelflags[0] = 0;
+  channelflags[1] = 0;
+  discslot = 0;
+  coincidence = COINC_OFF;
+  coincwindow = 0;
+  coincthreshold = 0;
+  coincrising = false;
+  coincslot = 1;
+  coincfound = 0;
+  coincmissing = 0;
+  coincvetoed = 0;
+  burstmemory = 64;
+  holdoff = 0;
+  capturelength = 0;
+  bursthugepages = false;
+  ringslots = 256;
   
   initialized = false;
   filename = "output";
@@ -48,19 +92,56 @@ TriggeredAcquisition::TriggeredAcquisition() {
   channelend = 8192;
   curvebend = 0;
 
-  datam = (int*) malloc(BUF * sizeof(int));
-  datamb = (int*) malloc(MULBUF * BUF * sizeof(int));
+  for(int i = 0; i < 2; i++) {
+    void * mem = NULL;
+    // Room for a capture of both channels
+    if(posix_memalign(&mem, 64, 2 * BUF * sizeof(int16_t)) != 0) {
+      mem = NULL;
+    }
+    tracebuf[i] = (int16_t *) mem;
+  }
+  trace = tracebuf[0];
+  memset(&timing, 0, sizeof(timing));
+  livetime = 0;
+  memset(&runstats, 0, sizeof(runstats));
+  waitexplicit = false;
+  records = new IntegralRecord[RECORDBUF];
+  recordcount = 0;
+
+  peakhist[0].SetBinning(1024, 0, 8192);
+  peakhist[1].SetBinning(1024, 0, 8192);
+  histpeak = false;
+  snapshotinterval = 10;
+  rateinterval = 1;
+  intervalhist.SetBinning(1000, 0, 10000);
+  nextsnapshot = 0;
+  snapshotbusy = false;
+  snapshotsskipped = 0;
+  datamb = NULL;
+  mulbatch = MULBUF;
+  mulalloc = 0;
+  mulcount = 0;
+  blockbuf = (uint8_t*) malloc(TRACEBLOCKBUF);
+  blockbytes = 0;
+  blocktraces = 0;
 
   verboseLevel = 0;
 
-  iface = new FPGAInterface();
+  iface = new DevMemFPGAInterface();
 }
 
 TriggeredAcquisition::~TriggeredAcquisition() {
   if(initialized) {
     iface->stopOscilloscope();
   }
-  free(datam);
+  free(datamb);
+  free(blockbuf);
+  free(tracebuf[0]);
+  free(tracebuf[1]);
+  delete [] records;
+  if(snapshotthread.joinable()) {
+    snapshotthread.join();
+  }
 
   delete iface;
 }
@@ -92,27 +173,67 @@ void TriggeredAcquisition::Measure(float length, MeasurementLengthType mlt) {
   int runcount = 0;
   int discarded = 0;
 
-  int trig_test;
-  int * cha_signal;
-  int * chb_signal;
-  int ptr;
-  int i;
-
   if(writeoff == WRITE_OFF_ASCII_SINGLE) {
     std::cout << "Measure, store in ascii file, write every data point separately" << std::endl;
   }
   else if(writeoff == WRITE_OFF_BINARY_SINGLE) {
     std::cout << "Measure, store in binary file, write every data point separately" << std::endl;
   }
+  else if(writeoff == WRITE_OFF_BINARY_MUL) {
+    std::cout << "Measure, store in binary file, write traces in batches of " << mulbatch << std::endl;
+  }
+  else if(writeoff == WRITE_OFF_BINARY_TRACE) {
+    std::cout << "Measure, store in compact binary trace file, delta + varint encoded" << std::endl;
+  }
   else if(writeoff == WRITE_OFF_ASCII_INTEGRAL) {
     std::cout << "Measure, store in ascii file, write integral over peak, baseline substracted, simple double peak rejection" << std::endl;
   }
   else if(writeoff == WRITE_OFF_JUST_CHECK) {
     std::cout << "Measure, no storage, just calculation of values useful for adjusting settings." << std::endl;
   }
+  else if(writeoff == WRITE_OFF_BINARY_INTEGRAL) {
+    std::cout << "Measure, store in binary file, write integral, peak and baseline as fixed size records" << std::endl;
+  }
+  else if(writeoff == WRITE_OFF_HISTOGRAM) {
+    std::cout << "Measure, histogram integral in memory, write spectrum every " << snapshotinterval << " s and at the end" << std::endl;
+  }
+  if(acquisition == ACQ_COPY_OUT) {
+    std::cout << "Copy trace out of FPGA memory and re-arm before processing" << std::endl;
+  }
+  else if(acquisition == ACQ_PIPELINE) {
+    std::cout << "Acquire and process events on separate threads" << std::endl;
+  }
+  else if(acquisition == ACQ_BURST) {
+    std::cout << "Capture traces into " << burstmemory << " MB of memory, write them after the measurement" << std::endl;
+  }
+  else if(acquisition == ACQ_STREAM) {
+    std::cout << "Free running oscilloscope, events are found by a software discriminator" << std::endl;
+  }
+
+  // The .bin header has no channel field, readers would take the
+  // interleaved B traces for channel A events
+  if(channel == CHANNEL_BOTH && (writeoff == WRITE_OFF_BINARY_SINGLE || writeoff == WRITE_OFF_BINARY_MUL)) {
+    std::cout << "Error: Both channels can not be recorded with output method " << WRITE_OFF_BINARY_SINGLE << " or " << WRITE_OFF_BINARY_MUL << ", use output method " << WRITE_OFF_BINARY_TRACE << "." << std::endl;
+    return;
+  }
+
+  if(capturelength > 0) {
+    if(acquisition == ACQ_PIPELINE || acquisition == ACQ_STREAM) {
+      std::cout << "Error: Long captures only work with acquisition method " << ACQ_DIRECT << ", " << ACQ_COPY_OUT << " or " << ACQ_BURST << "." << std::endl;
+      return;
+    }
+    if(capturelength < tracelength - pretriggerlength || pretriggerlength + capturelength > BUF) {
+      std::cout << "Error: Capture length must be between <tracelength> - <pretriggerlength> and " << BUF << " - <pretriggerlength>." << std::endl;
+      return;
+    }
+    if(!SetupDiscriminator()) {
+      return;
+    }
+    std::cout << "Capture " << capturelength << " samples per trigger, extract every event with the software trigger" << std::endl;
+  }
 
   // Set 'Trigger delay', number of data points to be acquired after trigger
-  iface->GetOscilloscopeMemory()->posttriggertracelength = tracelength;
+  iface->GetOscilloscopeMemory()->posttriggertracelength = capturelength > 0 ? capturelength : tracelength;
   if(verboseLevel > 0) {
     std::cout << "Set tracelength for FPGA module" << std::endl;
   }
@@ -124,7 +245,7 @@ void TriggeredAcquisition::Measure(float length, MeasurementLengthType mlt) {
   }
 
   // Reset Oscilloscope?
-  iface->GetOscilloscopeMemory()->configuration |= OSCRESETBIT;
+  iface->SetConfigurationBits(OSCRESETBIT);
 
   // Set Trigger Value (check for channel A / B)
   if(trigger == 2 || trigger == 3) { // Channel A
@@ -137,52 +258,43 @@ void TriggeredAcquisition::Measure(float length, MeasurementLengthType mlt) {
     std::cout << "Set trigger value for FPGA module" << std::endl;
   }
 
+  SelectChannels(iface->GetOscilloscopeChannelA(), iface->GetOscilloscopeChannelB());
+  if(nchannels > 1) {
+    std::cout << "Record channel A and B, two traces per event" << std::endl;
+  }
+  if(!SetupCoincidence()) {
+    return;
+  }
+  if(coincidence != COINC_OFF) {
+    std::cout << "Keep events " << (coincidence == COINC_REQUIRE ? "with" : "without") << " a pulse on channel B within "
+	      << coincwindow << " samples of the trigger" << std::endl;
+  }
+
+  if(acquisition == ACQ_BURST) {
+    // Reserve (and touch) the memory before the clock starts
+    size_t budget = (size_t) burstmemory * 1024 * 1024;
+    if(!burst.IsValid() || burst.GetBytes() < budget || burst.HasHugePages() != bursthugepages) {
+      if(!burst.Allocate(budget, bursthugepages)) {
+	return;
+      }
+    }
+    burst.Prepare(tracelength * nchannels);
+    if(burst.GetCapacity() < 1) {
+      std::cout << "Error: Memory for burst capture too small for a single trace" << std::endl;
+      return;
+    }
+    std::cout << "Memory for " << burst.GetCapacity() << " traces" << (burst.IsLocked() ? ", locked" : "")
+	      << (burst.HasHugePages() ? ", on huge pages" : "") << std::endl;
+  }
+
   std::chrono::high_resolution_clock::time_point starttime;
   typedef std::chrono::duration<double, std::milli> millisec_t;
   millisec_t clkDuration;
   starttime = std::chrono::high_resolution_clock::now();
 
   //  std::ofstream intfile("data.newbin", std::ios::out | std::ios::binary);
-  if (writeoff == WRITE_OFF_BINARY_SINGLE) {
-    std::string fullfile = filename + ".bin";
-    fh = fopen(fullfile.c_str(), "wb");
-    fwrite(&decimation, sizeof(int), 1, fh);
-    fwrite(&tracelength, sizeof(int), 1, fh);
-    fwrite(&pretriggerlength, sizeof(int), 1, fh);
-    fwrite(&triggervoltage, sizeof(float), 1, fh);
-    fwrite(&trigger, sizeof(int), 1, fh);
-  }
-  else if (writeoff == WRITE_OFF_ASCII_SINGLE){
-    std::string fullfile = filename + ".txt";
-    fh = fopen(fullfile.c_str(), "w");
-    if(verboseLevel > 0) {
-      std::cout << "Opened output ascii file" << std::endl;
-    }
-
-    std::string triggers = triggerString(trigger);
-    fprintf(fh, "Decimation:           %d\n", decimation);
-    fprintf(fh, "Trace length:         %d\n", tracelength);
-    fprintf(fh, "Pretrigger length:    %d\n", pretriggerlength);
-    fprintf(fh, "Trigger Value:        %f\n", triggervalue);
-    fprintf(fh, "Triggering on:        %s\n", triggers.c_str());
-  }
-  else if (writeoff == WRITE_OFF_ASCII_INTEGRAL){
-    std::string fullfile = filename + ".txt";
-    fh = fopen(fullfile.c_str(), "w");
-    if(verboseLevel > 0) {
-      std::cout << "Opened output ascii file" << std::endl;
-    }
-
-    std::string triggers = triggerString(trigger);
-    fprintf(fh, "Decimation:           %d\n", decimation);
-    fprintf(fh, "Trace length:         %d\n", tracelength);
-    fprintf(fh, "Pretrigger length:    %d\n", pretriggerlength);
-    fprintf(fh, "Trigger Value:        %f\n", triggervalue);
-    fprintf(fh, "Triggering on:        %s\n", triggers.c_str());
-    fprintf(fh, "Rej. Param. <min>     %f\n", ratiomin);
-    fprintf(fh, "Rej. Param. <max>     %f\n", ratiomax);
-    fprintf(fh, "Rej. Param. <s>       %d\n", channelstart);
-    fprintf(fh, "Rej. Param. <e>       %d\n", channelend);
+  if(!OpenOutput()) {
+    return;
   }
 
   if(verboseLevel > 0) {
@@ -190,25 +302,68 @@ void TriggeredAcquisition::Measure(float length, MeasurementLengthType mlt) {
   }
 
   mulcount = 0;
+  ratewindowstart = 0;
+  ratecount = 0;
+  ratepeak = 0;
+  bool burstmode = (acquisition == ACQ_BURST);
+  bool copyout = (acquisition == ACQ_COPY_OUT) || burstmode;
+  bool armed = false;
+  int cur = 0;
+  bool triggerseen = false;
+  std::chrono::high_resolution_clock::time_point triggertime;
+  std::chrono::high_resolution_clock::duration deadtime(0);
+  std::chrono::high_resolution_clock::time_point armclock = starttime;
+  uint32_t armwp = 0;
+  int captures = 0;
+  livetime = 0;
+  profiler.Reset();
+  waiter.Prepare(iface);
+  bool rt = realtime.IsEnabled();
+  if(rt) {
+    PrepareRealtime();
+    if(acquisition != ACQ_PIPELINE) {
+      // The pipeline raises its acquisition thread only
+      realtime.Enter();
+    }
+  }
+  if(acquisition == ACQ_PIPELINE) {
+    MeasurePipeline(length, mlt, starttime, runcount, discarded, deadtime);
+    runcondition = false;
+  }
+  else if(acquisition == ACQ_STREAM) {
+    MeasureStream(length, mlt, starttime, runcount, discarded, deadtime);
+    runcondition = false;
+  }
   while(runcondition) {
     // Arm Trigger and set to Trigger method
-    iface->GetOscilloscopeMemory()->configuration |= TRIGGERARMBIT;
-    iface->GetOscilloscopeMemory()->trigger = trigger;
-
-    // Test if triggered, with protection of 10s if no trigger happens
-    std::chrono::high_resolution_clock::time_point triggerstarttime;
-    millisec_t triggerduration;
-    triggerstarttime = std::chrono::high_resolution_clock::now();
-    trig_test = iface->GetOscilloscopeMemory()->trigger;
-    while (trig_test!=0) {
-      triggerduration = std::chrono::duration_cast<millisec_t>(std::chrono::high_resolution_clock::now() - triggerstarttime);
-      if(triggerduration.count() / 1000 > 10) {
-	std::cout << "Did not trigger for more than 10 s - will stop now!" << std::endl;
-	std::cout << "This could be due to wrong trigger settings." << std::endl;
-	runcondition = false;
-	break;
+    if(!armed) {
+      PROFILE_MARK(profiler);
+      iface->SetConfigurationBits(TRIGGERARMBIT);
+      iface->GetOscilloscopeMemory()->trigger = trigger;
+      armclock = std::chrono::high_resolution_clock::now();
+      armwp = iface->GetOscilloscopeMemory()->writepointer;
+      PROFILE_STAGE(profiler, STAGE_ARM);
+      if(triggerseen) {
+	deadtime += std::chrono::high_resolution_clock::now() - triggertime;
       }
-      trig_test = iface->GetOscilloscopeMemory()->trigger;
+    }
+    armed = false;
+
+    // Test if triggered, with protection if no trigger happens
+    if(!waiter.Wait(iface->GetOscilloscopeMemory())) {
+      std::cout << "Did not trigger for more than " << waiter.GetSettings().timeout << " s - will stop now!" << std::endl;
+      std::cout << "This could be due to wrong trigger settings." << std::endl;
+      runcondition = false;
+    }
+    triggertime = std::chrono::high_resolution_clock::now();
+    PROFILE_STAGE(profiler, STAGE_WAIT);
+    if(rt) {
+      realtime.Mark();
+    }
+    triggerseen = true;
+    if(!runcondition) {
+      // Armed until the timeout, still live time
+      livetime += std::chrono::duration_cast<std::chrono::nanoseconds>(triggertime - armclock).count();
     }
     if(verboseLevel > 1) {
       std::cout << "Event triggered" << std::endl;
@@ -219,25 +374,69 @@ void TriggeredAcquisition::Measure(float length, MeasurementLengthType mlt) {
       
       // Get Memory pointers
       trig_ptr = iface->GetOscilloscopeMemory()->triggerpointer;
-      signal_start_ptr = iface->GetOscilloscopeChannelA(); // FIX depending on measure channel
 
-      // Write Data depending on method
-      if(writeoff == WRITE_OFF_BINARY_SINGLE) {
-	WriteOffBinarySingle();
+      int16_t * window = tracebuf[cur];
+      if(capturelength > 0) {
+	// Copy the whole capture, the events are cut out of it
+	int capturestart = trig_ptr - pretriggerlength;
+	if(capturestart < 0) {
+	  capturestart += BUF;
+	}
+	for(int c = 0; c < nchannels; c++) {
+	  ::ExtractTrace(measuresrc[c], BUF, capturestart, pretriggerlength + capturelength, window + c * BUF);
+	}
+	if(coincidence != COINC_OFF && channel == CHANNEL_A) {
+	  ::ExtractTrace(iface->GetOscilloscopeChannelB(), BUF, capturestart, pretriggerlength + capturelength, window + coincslot * BUF);
+	}
+      }
+      else {
+	trace = burstmode ? burst.Next() : tracebuf[cur];
+	ExtractEvent(trig_ptr, trace);
       }
-      else if(writeoff == WRITE_OFF_ASCII_SINGLE) {
-	WriteOffAsciiSingle();
+      PROFILE_STAGE(profiler, STAGE_COPY);
+      // Channel B is tested while the FPGA memory still holds the event,
+      // events of long captures are tested one by one
+      bool keep = capturelength > 0 || CoincidenceTest(iface->GetOscilloscopeChannelB(), trig_ptr);
+      PROFILE_STAGE(profiler, STAGE_SEARCH);
+      timing.armtime = std::chrono::duration_cast<std::chrono::nanoseconds>(armclock - starttime).count();
+      timing.observedtime = std::chrono::duration_cast<std::chrono::nanoseconds>(triggertime - starttime).count();
+      timing.triggertime = TriggerSampleTime(timing, armwp, trig_ptr, capturelength > 0 ? capturelength : tracelength);
+      livetime += timing.triggertime - timing.armtime;
+
+      if(copyout) {
+	// Trace is out of the FPGA memory, re-arm right away, the next
+	// event is captured while this one is processed
+	iface->SetConfigurationBits(TRIGGERARMBIT);
+	iface->GetOscilloscopeMemory()->trigger = trigger;
+	armclock = std::chrono::high_resolution_clock::now();
+	armwp = iface->GetOscilloscopeMemory()->writepointer;
+	PROFILE_STAGE(profiler, STAGE_ARM);
+	armed = true;
+	deadtime += std::chrono::high_resolution_clock::now() - triggertime;
+	triggerseen = false;
+	cur ^= 1;
       }
-      else if(writeoff == WRITE_OFF_ASCII_INTEGRAL) {
-	if(!WriteOffAsciiIntegral()) {
+
+      if(capturelength > 0) {
+	int maxevents = (mlt == LENGTH_IS_TIME) ? BUF : traces - runcount;
+	runcount += WriteOffCapture(window, maxevents, discarded);
+	captures++;
+      }
+      else if(keep) {
+	if(burstmode) {
+	  // No processing and no I/O until the measurement is over
+	  burst.Push(timing);
+	}
+	else if(!WriteOff()) {
 	  discarded++;
 	}
+	runcount++;
       }
-      else if(writeoff == WRITE_OFF_JUST_CHECK) {
-	WriteOffJustCheck();
+      if(burstmode && burst.IsFull()) {
+	std::cout << "Memory for burst capture full, stopping." << std::endl;
+	runcondition = false;
       }
 
-      runcount++;
       if(mlt == LENGTH_IS_TIME) {
 	clkDuration = std::chrono::duration_cast<millisec_t>(std::chrono::high_resolution_clock::now() - starttime);
 	if(verboseLevel > 1) {
@@ -252,12 +451,65 @@ void TriggeredAcquisition::Measure(float length, MeasurementLengthType mlt) {
 	  runcondition = false;
 	}
       }
+      if(rt) {
+	realtime.Record();
+      }
     }
 
   }
-  clkDuration = std::chrono::duration_cast<millisec_t>(std::chrono::high_resolution_clock::now() - starttime);
+  std::chrono::high_resolution_clock::time_point endtime = std::chrono::high_resolution_clock::now();
+  if(rt && acquisition != ACQ_PIPELINE) {
+    realtime.Leave();
+  }
+  if(armed) {
+    livetime += std::chrono::duration_cast<std::chrono::nanoseconds>(endtime - armclock).count();
+  }
+  clkDuration = std::chrono::duration_cast<millisec_t>(endtime - starttime);
+  double realtime = clkDuration.count() / 1000;
+  double live = livetime * 1e-9;
   std::cout << "Sampled " << runcount << " traces in " << clkDuration.count()  << "ms (" << runcount / clkDuration.count() * 1000 << " traces/s)."<< std::endl;
-  if (writeoff == WRITE_OFF_ASCII_INTEGRAL) { 
+  if(runcount > 0) {
+    millisec_t deadms = std::chrono::duration_cast<millisec_t>(deadtime);
+    std::cout << "Dead time " << deadms.count() * 1000 / runcount << " us per event (" << 100 * deadms.count() / clkDuration.count() << " % of measurement time)." << std::endl;
+  }
+  std::cout << "Real time " << realtime << " s, live time " << live << " s (dead time fraction " << (realtime > 0 ? 100 * (1 - live / realtime) : 0) << " %)." << std::endl;
+  if(captures > 0) {
+    std::cout << captures << " captures, " << 1.0 * runcount / captures << " events per capture." << std::endl;
+  }
+  if(acquisition == ACQ_BURST) {
+    std::chrono::high_resolution_clock::time_point flushstart = std::chrono::high_resolution_clock::now();
+    for(int e = 0; e < burst.GetCount(); e++) {
+      trace = burst.GetTrace(e);
+      timing = burst.GetTiming(e);
+      PROFILE_MARK(profiler);
+      if(!WriteOff()) {
+	discarded++;
+      }
+    }
+    millisec_t flushms = std::chrono::duration_cast<millisec_t>(std::chrono::high_resolution_clock::now() - flushstart);
+    std::cout << "Processed " << burst.GetCount() << " traces from memory in " << flushms.count() << "ms." << std::endl;
+  }
+  if(runcount > 0) {
+    if(ratecount > ratepeak) {
+      ratepeak = ratecount;
+    }
+    std::cout << "Peak trigger rate " << ratepeak * 1e9 / RATEWINDOW << " triggers/s (" << RATEWINDOW / 1000000 << " ms windows)." << std::endl;
+  }
+  if(acquisition != ACQ_STREAM) {
+    waiter.Print();
+  }
+  if(rt) {
+    FinishRealtime();
+  }
+  if(coincidence != COINC_OFF) {
+    std::cout << "Coincidence: " << coincfound << " events with a pulse on channel B, " << coincmissing << " without, "
+	      << coincvetoed << " not recorded." << std::endl;
+  }
+  runstats.events = runcount;
+  runstats.rejected = discarded;
+  runstats.realtime = realtime;
+  runstats.livetime = live;
+  if (writeoff == WRITE_OFF_ASCII_INTEGRAL || writeoff == WRITE_OFF_BINARY_INTEGRAL || writeoff == WRITE_OFF_HISTOGRAM) { 
     std::cout << "Discarded " << discarded << " traces because of rejection conditions" << std::endl;
   }
   //    intfile.close();
@@ -290,14 +542,608 @@ void TriggeredAcquisition::Measure(float length, MeasurementLengthType mlt) {
     }
 
     std::cout << "Results: " << std::endl;
-    std::cout << "Average area/peak: " << 1.0 * avgintegpeak / runcount << std::endl;
+    std::cout << "Average area/peak: " << 1.0 * avgintegpeak / (runcount * nchannels) << std::endl;
     std::cout << "Most frequent peak position: " << peak1 << " (" << max1 << " times)"<< std::endl;
     std::cout << "Second most frequent peak position: " << peak2 << " (" << max2 << " times)"<< std::endl;
     std::cout << "Third most frequent peak position: " << peak3 << " (" << max3 << " times)"<< std::endl;
   }
+  else if(writeoff == WRITE_OFF_HISTOGRAM) {
+    if(snapshotthread.joinable()) {
+      snapshotthread.join();
+    }
+    SaveSpectra(inthist, peakhist, realtime, live);
+    for(int c = 0; c < nchannels; c++) {
+      std::cout << "Spectrum with " << inthist[c].GetEntries() << " entries written to " << SpectrumName(c, ".spectrum") << std::endl;
+    }
+    if(snapshotsskipped > 0) {
+      std::cout << "Skipped " << snapshotsskipped << " snapshots, previous snapshot was still being written" << std::endl;
+    }
+  }
   else {
-    fclose(fh);
+    CloseOutput(runcount, discarded, realtime);
+    out.DumpStatistics();
+  }
+  DumpProfile("measure");
+}
+
+bool TriggeredAcquisition::OpenOutput() {
+  // Output file and header of the write off method
+  SelectWriteOff();
+  if (writeoff == WRITE_OFF_BINARY_MUL) {
+    // Batch buffer for mulbatch traces, only grown if needed
+    if(mulalloc < mulbatch * tracelength) {
+      free(datamb);
+      mulalloc = mulbatch * tracelength;
+      datamb = (int*) malloc(mulalloc * sizeof(int));
+    }
+  }
+  if (writeoff == WRITE_OFF_BINARY_SINGLE || writeoff == WRITE_OFF_BINARY_MUL) {
+    std::string fullfile = filename + ".bin";
+    if(!out.Open(fullfile)) {
+      return false;
+    }
+    out.Write(&decimation, sizeof(int));
+    out.Write(&tracelength, sizeof(int));
+    out.Write(&pretriggerlength, sizeof(int));
+    out.Write(&triggervoltage, sizeof(float));
+    out.Write(&trigger, sizeof(int));
+  }
+  else if (writeoff == WRITE_OFF_ASCII_SINGLE){
+    std::string fullfile = filename + ".txt";
+    if(!out.Open(fullfile)) {
+      return false;
+    }
+    if(verboseLevel > 0) {
+      std::cout << "Opened output ascii file" << std::endl;
+    }
+
+    std::string header = textHeader(decimation, tracelength, pretriggerlength, triggervalue, trigger);
+    out.Write(header.data(), header.size());
+    if(channel != CHANNEL_A) {
+      out.Printf("Channels:             %s\n", channelString(channel).c_str());
+    }
+  }
+  else if (writeoff == WRITE_OFF_ASCII_INTEGRAL){
+    std::string fullfile = filename + ".txt";
+    if(!out.Open(fullfile)) {
+      return false;
+    }
+    if(verboseLevel > 0) {
+      std::cout << "Opened output ascii file" << std::endl;
+    }
+
+    std::string header = textHeader(decimation, tracelength, pretriggerlength, triggervalue, trigger);
+    out.Write(header.data(), header.size());
+    out.Printf("Rej. Param. <min>     %f\n", ratiomin);
+    out.Printf("Rej. Param. <max>     %f\n", ratiomax);
+    out.Printf("Rej. Param. <s>       %d\n", channelstart);
+    out.Printf("Rej. Param. <e>       %d\n", channelend);
+    if(channel != CHANNEL_A) {
+      out.Printf("Channels:             %s\n", channelString(channel).c_str());
+    }
+  }
+  else if (writeoff == WRITE_OFF_BINARY_INTEGRAL) {
+    std::string fullfile = filename + ".ibin";
+    if(!out.Open(fullfile)) {
+      return false;
+    }
+    if(verboseLevel > 0) {
+      std::cout << "Opened output binary integral file" << std::endl;
+    }
+
+    IntegralFileHeader header;
+    memset(&header, 0, sizeof(header));
+    strncpy(header.magic, INTEGRALFILEMAGIC, sizeof(header.magic));
+    header.version = INTEGRALFILEVERSION;
+    header.headersize = sizeof(IntegralFileHeader);
+    header.recordsize = sizeof(IntegralRecord);
+    header.decimation = decimation;
+    header.tracelength = tracelength;
+    header.pretriggerlength = pretriggerlength;
+    header.triggervalue = triggervalue;
+    header.trigger = trigger;
+    header.triggervoltage = triggervoltage;
+    header.ratiomin = ratiomin;
+    header.ratiomax = ratiomax;
+    header.channelstart = channelstart;
+    header.channelend = channelend;
+    header.curvebend = curvebend;
+    header.baselinelength = BASELINELENGTH;
+    header.footersize = sizeof(RunFooter);
+    header.channels = channel;
+    out.Write(&header, sizeof(header));
+    recordcount = 0;
+  }
+  else if (writeoff == WRITE_OFF_BINARY_TRACE) {
+    std::string fullfile = filename + ".trc";
+    if(!out.Open(fullfile)) {
+      return false;
+    }
+    if(verboseLevel > 0) {
+      std::cout << "Opened output binary trace file" << std::endl;
+    }
+
+    TraceFileHeader header;
+    memset(&header, 0, sizeof(header));
+    strncpy(header.magic, TRACEFILEMAGIC, sizeof(header.magic));
+    header.version = TRACEFILEVERSION;
+    header.headersize = sizeof(TraceFileHeader);
+    header.encoding = TRACE_ENCODING_DELTA_VARINT;
+    header.decimation = decimation;
+    header.tracelength = tracelength;
+    header.pretriggerlength = pretriggerlength;
+    header.triggervalue = triggervalue;
+    header.trigger = trigger;
+    header.triggervoltage = triggervoltage;
+    header.footersize = sizeof(RunFooter);
+    header.channels = channel;
+    out.Write(&header, sizeof(header));
+    blockbytes = 0;
+    blocktraces = 0;
+  }
+  else if (writeoff == WRITE_OFF_HISTOGRAM) {
+    for(int c = 0; c < 2; c++) {
+      inthist[c].Reset();
+      peakhist[c].Reset();
+    }
+    nextsnapshot = (uint64_t) (snapshotinterval * 1e9);
+    snapshotsskipped = 0;
+  }
+  return true;
+}
+
+void TriggeredAcquisition::CloseOutput(int runcount, int discarded, double realtime) {
+  if(writeoff == WRITE_OFF_BINARY_INTEGRAL) {
+    FlushRecords();
+    WriteRunFooter(runcount, discarded, realtime);
+  }
+  else if(writeoff == WRITE_OFF_BINARY_MUL) {
+    FlushMul();
+  }
+  else if(writeoff == WRITE_OFF_BINARY_TRACE) {
+    FlushTraceBlock();
+    WriteRunFooter(runcount, discarded, realtime);
+  }
+  if(writeoff != WRITE_OFF_JUST_CHECK && writeoff != WRITE_OFF_HISTOGRAM) {
+    out.Close();
+  }
+}
+
+int TriggeredAcquisition::Replay(uint32_t * ring, const int * trigptrs, int ntriggers, int events) {
+  // Same processing as Measure for traces already in memory, no FPGA and
+  // no waiting; the trigger positions are used round robin, events are
+  // 1 us apart. Both channels (if selected) read the same ring.
+  SelectChannels(ring, ring);
+  if(ntriggers < 1 || !OpenOutput()) {
+    return -1;
+  }
+  mulcount = 0;
+  ratewindowstart = 0;
+  ratecount = 0;
+  ratepeak = 0;
+  livetime = 0;
+  memset(&timing, 0, sizeof(timing));
+  int discarded = 0;
+  for(int e = 0; e < events; e++) {
+    trace = tracebuf[0];
+    ExtractEvent(trigptrs[e % ntriggers], trace);
+    timing.triggertime += 1000;
+    if(!WriteOff()) {
+      discarded++;
+    }
+  }
+  if(snapshotthread.joinable()) {
+    snapshotthread.join();
+  }
+  CloseOutput(events, discarded, timing.triggertime * 1e-9);
+  return discarded;
+}
+
+void TriggeredAcquisition::MeasurePipeline(float length, MeasurementLengthType mlt,
+					   std::chrono::high_resolution_clock::time_point starttime,
+					   int & runcount, int & discarded,
+					   std::chrono::high_resolution_clock::duration & deadtime) {
+  typedef std::chrono::high_resolution_clock hrclock;
+  typedef std::chrono::duration<double, std::milli> millisec_t;
+
+  EventRing ring(ringslots, tracelength * nchannels);
+  if(!ring.IsValid()) {
+    std::cout << "Error: Could not allocate event ring with " << ringslots << " slots." << std::endl;
+    return;
+  }
+
+  std::atomic<bool> done(false);
+  int captured = 0;
+  int overflows = 0;
+  int maxfill = 0;
+  hrclock::duration acqdeadtime(0);
+
+  cpu_set_t oldset;
+  pthread_getaffinity_np(pthread_self(), sizeof(oldset), &oldset);
+
+  // Acquisition thread: trigger polling and trace copy only
+  StageProfiler acqprofiler;
+  bool rt = realtime.IsEnabled();
+  std::thread acq([&]() {
+      if(rt) {
+	// Enter() moves the thread to the real-time core, if one is given
+	PinCurrentThread(0);
+      }
+      realtime.Enter();
+      int traces = (int) length;
+      bool runcondition = true;
+      volatile oscilloscope_mem * mem = iface->GetOscilloscopeMemory();
+      uint32_t * coincchannel = iface->GetOscilloscopeChannelB();
+
+      PROFILE_MARK(acqprofiler);
+      iface->SetConfigurationBits(TRIGGERARMBIT);
+      mem->trigger = trigger;
+      hrclock::time_point armclock = hrclock::now();
+      uint32_t armwp = mem->writepointer;
+      PROFILE_STAGE(acqprofiler, STAGE_ARM);
+      while(runcondition) {
+	// Test if triggered, with protection if no trigger happens
+	if(!waiter.Wait(mem)) {
+	  std::cout << "Did not trigger for more than " << waiter.GetSettings().timeout << " s - will stop now!" << std::endl;
+	  std::cout << "This could be due to wrong trigger settings." << std::endl;
+	  break;
+	}
+	hrclock::time_point triggertime = hrclock::now();
+	PROFILE_STAGE(acqprofiler, STAGE_WAIT);
+	if(rt) {
+	  realtime.Mark();
+	}
+
+	// Copy into a free slot, the event is lost if the ring is full;
+	// filtered events do not take a slot
+	bool keep = CoincidenceTest(coincchannel, mem->triggerpointer);
+	EventSlot * slot = keep ? ring.Claim() : NULL;
+	if(slot) {
+	  ExtractEvent(mem->triggerpointer, slot->samples);
+	}
+	PROFILE_STAGE(acqprofiler, STAGE_COPY);
+	EventTiming eventtiming;
+	eventtiming.armtime = std::chrono::duration_cast<std::chrono::nanoseconds>(armclock - starttime).count();
+	eventtiming.observedtime = std::chrono::duration_cast<std::chrono::nanoseconds>(triggertime - starttime).count();
+	eventtiming.triggertime = TriggerSampleTime(eventtiming, armwp, mem->triggerpointer, tracelength);
+	livetime += eventtiming.triggertime - eventtiming.armtime;
+	if(slot) {
+	  slot->timing = eventtiming;
+	}
+	iface->SetConfigurationBits(TRIGGERARMBIT);
+	mem->trigger = trigger;
+	armclock = hrclock::now();
+	armwp = mem->writepointer;
+	PROFILE_STAGE(acqprofiler, STAGE_ARM);
+	acqdeadtime += armclock - triggertime;
+
+	if(slot) {
+	  ring.Publish();
+	  captured++;
+	  int fill = ring.GetFill();
+	  if(fill > maxfill) {
+	    maxfill = fill;
+	  }
+	}
+	else if(keep) {
+	  overflows++;
+	}
+
+	if(mlt == LENGTH_IS_TIME) {
+	  if(std::chrono::duration_cast<millisec_t>(hrclock::now() - starttime).count() / 1000 > length) {
+	    runcondition = false;
+	  }
+	}
+	else if(captured >= traces) {
+	  runcondition = false;
+	}
+	if(rt) {
+	  realtime.Record();
+	}
+      }
+      livetime += std::chrono::duration_cast<std::chrono::nanoseconds>(hrclock::now() - armclock).count();
+      realtime.Leave();
+      done.store(true, std::memory_order_release);
+    });
+
+  // Processing thread: output methods work on the copied traces,
+  // not on the core of a real-time acquisition thread. Without -Q both
+  // threads keep the normal scheduling
+  if(rt) {
+    PinCurrentThread(realtime.GetSettings().core == 1 ? 0 : 1);
+  }
+  while(true) {
+    EventSlot * slot = ring.Peek();
+    if(!slot) {
+      if(done.load(std::memory_order_acquire)) {
+	slot = ring.Peek();
+	if(!slot) {
+	  break;
+	}
+      }
+      else {
+	std::this_thread::yield();
+	continue;
+      }
+    }
+    trace = slot->samples;
+    timing = slot->timing;
+    PROFILE_MARK(profiler);
+    if(!WriteOff()) {
+      discarded++;
+    }
+    runcount++;
+    ring.Release();
+  }
+  acq.join();
+  profiler.Merge(acqprofiler);
+  pthread_setaffinity_np(pthread_self(), sizeof(oldset), &oldset);
+
+  deadtime += acqdeadtime;
+  std::cout << "Event ring: " << ring.GetSize() << " slots, maximum fill " << maxfill << ", " << overflows << " events lost because ring was full." << std::endl;
+}
+
+bool TriggeredAcquisition::SetupCoincidence() {
+  coincfound = 0;
+  coincmissing = 0;
+  coincvetoed = 0;
+  if(coincidence == COINC_OFF) {
+    return true;
+  }
+  if(trigger != TRIG_A_POS_EDGE && trigger != TRIG_A_NEG_EDGE) {
+    std::cout << "Error: The coincidence filter needs an edge trigger on channel A (trigger method 2 or 3)." << std::endl;
+    return false;
+  }
+  // The samples after the trigger are only valid for one trace
+  if(coincwindow >= tracelength - pretriggerlength) {
+    std::cout << "Error: Coincidence window must be shorter than <tracelength> - <pretriggerlength>." << std::endl;
+    return false;
+  }
+  coincrising = (trigger == TRIG_A_POS_EDGE);
+  // Long captures of channel B go next to the recorded ones
+  coincslot = channel == CHANNEL_B ? 0 : 1;
+  return true;
+}
+
+// Leading edge in n samples from start of a ring of size samples. beyond
+// starts true, so the first sample only gives the state before the window
+template <typename T>
+static bool PulseInWindow(const T * src, int size, int start, int n, int threshold, bool rising) {
+  bool beyond = true;
+  start = (start % size + size) % size;
+  while(n > 0) {
+    int len = size - start < n ? size - start : n;
+    if(FindCrossing(src + start, len, threshold, rising, beyond) >= 0) {
+      return true;
+    }
+    n -= len;
+    start = 0;
+  }
+  return false;
+}
+
+inline bool TriggeredAcquisition::CoincidenceKeep(bool pulse) {
+  if(pulse) {
+    coincfound++;
+  }
+  else {
+    coincmissing++;
+  }
+  bool keep = pulse == (coincidence == COINC_REQUIRE);
+  if(!keep) {
+    coincvetoed++;
+  }
+  return keep;
+}
+
+inline bool TriggeredAcquisition::CoincidenceTest(const uint32_t * ring, int position) {
+  // Pulse on channel B starting within coincwindow samples of the trigger
+  if(coincidence == COINC_OFF) {
+    return true;
+  }
+  return CoincidenceKeep(PulseInWindow(ring, BUF, position - coincwindow - 1, 2 * coincwindow + 2, coincthreshold, coincrising));
+}
+
+inline bool TriggeredAcquisition::CoincidenceTest(const int16_t * capture, int n, int position) {
+  // Same within a long capture, the window ends at the capture
+  if(coincidence == COINC_OFF) {
+    return true;
+  }
+  int start = position - coincwindow - 1 > 0 ? position - coincwindow - 1 : 0;
+  int end = position + coincwindow + 1 < n ? position + coincwindow + 1 : n;
+  return CoincidenceKeep(PulseInWindow(capture, n, start, end - start, coincthreshold, coincrising));
+}
+
+bool TriggeredAcquisition::SetupDiscriminator() {
+  if(trigger < TRIG_A_POS_EDGE || trigger > TRIG_B_NEG_EDGE) {
+    std::cout << "Error: The software trigger needs an edge trigger on channel A or B (trigger method 2 to 5)." << std::endl;
+    return false;
+  }
+  discrising = (trigger == TRIG_A_POS_EDGE || trigger == TRIG_B_POS_EDGE);
+  discthreshold = SignedSample(triggervalue);
+  dischold = holdoff > 0 ? holdoff : tracelength - pretriggerlength;
+  if(dischold < 1) {
+    dischold = 1;
+  }
+  return true;
+}
+
+void TriggeredAcquisition::MeasureStream(float length, MeasurementLengthType mlt,
+					 std::chrono::high_resolution_clock::time_point starttime,
+					 int & runcount, int & discarded,
+					 std::chrono::high_resolution_clock::duration & deadtime) {
+  typedef std::chrono::high_resolution_clock hrclock;
+  typedef std::chrono::duration<double, std::milli> millisec_t;
+
+  if(!SetupDiscriminator()) {
+    return;
+  }
+  int traces = (int) length;
+  volatile oscilloscope_mem * mem = iface->GetOscilloscopeMemory();
+  bool onB = (trigger == TRIG_B_POS_EDGE || trigger == TRIG_B_NEG_EDGE);
+  uint32_t * discchannel = onB ? iface->GetOscilloscopeChannelB() : iface->GetOscilloscopeChannelA();
+  uint32_t * coincchannel = iface->GetOscilloscopeChannelB();
+  double nspersample = 1e9 * decimation / ADCSAMPLERATE;
+
+  // Events found by the discriminator, waiting for their post trigger samples
+  std::vector<uint64_t> pending(BUF);
+  std::vector<uint64_t> pendingarm(BUF);
+  int pendinghead = 0;
+  int pendingcount = 0;
+
+  uint64_t written = 0;                  // samples written since the start
+  uint64_t scanned = pretriggerlength;   // next sample for the discriminator
+  bool beyond = true;                    // no trigger before the signal was below threshold
+  uint64_t overruns = 0;
+  uint64_t lostsamples = 0;
+  uint64_t lostevents = 0;
+  uint64_t armsample = scanned;          // discriminator ready again after holdoff or overrun
+  uint64_t holdsamples = 0;
+
+  // Free running: armed without trigger source, the ring is written continuously
+  mem->trigger = TRIG_NO_ACQUISITION;
+  iface->SetConfigurationBits(TRIGGERARMBIT);
+  uint32_t lastwp = mem->writepointer % BUF;
+  hrclock::time_point lastpoll = hrclock::now();
+  double streamstart = std::chrono::duration<double, std::nano>(lastpoll - starttime).count();
+  hrclock::time_point lastmove = lastpoll;
+
+  bool runcondition = true;
+  bool rt = realtime.IsEnabled();
+  PROFILE_MARK(profiler);
+  while(runcondition) {
+    uint32_t wp = mem->writepointer % BUF;
+    hrclock::time_point now = hrclock::now();
+    uint32_t delta = (wp + BUF - lastwp) % BUF;
+    // The pointer only gives the position in the ring, complete laps
+    // since the last poll are estimated from the sample clock
+    double expected = std::chrono::duration<double, std::nano>(now - lastpoll).count() / nspersample;
+    if(delta == 0 && expected < BUF / 2) {
+      if(std::chrono::duration_cast<millisec_t>(now - lastmove).count() > 1000) {
+	std::cout << "Oscilloscope memory was not written for more than 1 s - will stop now!" << std::endl;
+	break;
+      }
+      continue;
+    }
+    uint64_t laps = 0;
+    if(expected > delta + BUF / 2) {
+      laps = (uint64_t) ((expected - delta) / BUF + 0.5);
+    }
+    written += delta + laps * BUF;
+    lastwp = wp;
+    lastpoll = now;
+    lastmove = now;
+    PROFILE_STAGE(profiler, STAGE_WAIT);
+    if(rt) {
+      realtime.Mark();
+    }
+
+    // Overrun: samples still needed were (or are about to be) overwritten
+    uint64_t oldest = scanned - pretriggerlength;
+    if(pendingcount > 0 && pending[pendinghead] - pretriggerlength < oldest) {
+      oldest = pending[pendinghead] - pretriggerlength;
+    }
+    if(written - oldest > (uint64_t) (BUF - STREAMGUARD)) {
+      uint64_t valid = written - (BUF - STREAMGUARD);
+      overruns++;
+      while(pendingcount > 0 && pending[pendinghead] - pretriggerlength < valid) {
+	pendinghead = (pendinghead + 1) % BUF;
+	pendingcount--;
+	lostevents++;
+      }
+      if(scanned < valid + pretriggerlength) {
+	lostsamples += valid + pretriggerlength - scanned;
+	scanned = valid + pretriggerlength;
+	armsample = scanned;
+	beyond = true;
+      }
+    }
+
+    // Software leading edge discriminator over the new samples
+    while(scanned < written) {
+      int start = scanned % BUF;
+      int n = BUF - start;
+      if((uint64_t) n > written - scanned) {
+	n = written - scanned;
+      }
+      int r = FindCrossing(discchannel + start, n, discthreshold, discrising, beyond);
+      if(r < 0) {
+	scanned += n;
+	continue;
+      }
+      if(pendingcount < BUF) {
+	pending[(pendinghead + pendingcount) % BUF] = scanned + r;
+	pendingarm[(pendinghead + pendingcount) % BUF] = armsample;
+	pendingcount++;
+      }
+      else {
+	// No room to remember the crossing
+	lostevents++;
+      }
+      // Holdoff, a new event needs the signal to return first
+      scanned += r + dischold;
+      holdsamples += dischold;
+      armsample = scanned;
+      beyond = true;
+    }
+    PROFILE_STAGE(profiler, STAGE_SEARCH);
+
+    // Cut out complete events
+    while(runcondition && pendingcount > 0 && pending[pendinghead] - pretriggerlength + tracelength <= written) {
+      uint64_t t = pending[pendinghead];
+      uint64_t armedat = pendingarm[pendinghead];
+      pendinghead = (pendinghead + 1) % BUF;
+      pendingcount--;
+      for(int c = 0; c < nchannels; c++) {
+	::ExtractTrace(measuresrc[c], BUF, (t - pretriggerlength) % BUF, tracelength, tracebuf[0] + c * tracelength);
+      }
+      PROFILE_STAGE(profiler, STAGE_COPY);
+      // Check that the writer did not reach the trace during the copy
+      double since = std::chrono::duration<double, std::nano>(hrclock::now() - lastpoll).count() / nspersample;
+      if(written - (t - pretriggerlength) + since > BUF) {
+	lostevents++;
+	continue;
+      }
+      if(!CoincidenceTest(coincchannel, t % BUF)) {
+	continue;
+      }
+      trace = tracebuf[0];
+      timing.armtime = (uint64_t) (streamstart + armedat * nspersample);
+      timing.observedtime = std::chrono::duration_cast<std::chrono::nanoseconds>(hrclock::now() - starttime).count();
+      timing.triggertime = (uint64_t) (streamstart + t * nspersample);
+      if(!WriteOff()) {
+	discarded++;
+      }
+
+      runcount++;
+      if(mlt == LENGTH_IS_TIME) {
+	if(std::chrono::duration_cast<millisec_t>(hrclock::now() - starttime).count() / 1000 > length) {
+	  runcondition = false;
+	}
+      }
+      else if(runcount >= traces) {
+	runcondition = false;
+      }
+    }
+    if(runcondition && mlt == LENGTH_IS_TIME) {
+      if(std::chrono::duration_cast<millisec_t>(hrclock::now() - starttime).count() / 1000 > length) {
+	runcondition = false;
+      }
+    }
+    if(rt) {
+      realtime.Record();
+    }
   }
+  // Stop the free running oscilloscope
+  iface->SetConfigurationBits(OSCRESETBIT);
+
+  deadtime += std::chrono::duration_cast<hrclock::duration>(std::chrono::duration<double, std::nano>(lostsamples * nspersample));
+  // Live: every searched sample outside the holdoff windows
+  uint64_t deadsamples = lostsamples + holdsamples;
+  livetime += (uint64_t) ((written > deadsamples ? written - deadsamples : 0) * nspersample);
+  std::cout << "Stream: " << written << " samples, " << overruns << " ring overruns, " << lostsamples << " samples ("
+	    << (written > 0 ? 100.0 * lostsamples / written : 0) << " %) not searched, "
+	    << lostevents << " events lost." << std::endl;
 }
 
 void TriggeredAcquisition::Geiger(float length, MeasurementLengthType mlt) {
@@ -305,18 +1151,15 @@ void TriggeredAcquisition::Geiger(float length, MeasurementLengthType mlt) {
   bool runcondition = true;
   int runcount = 0;
 
-  int trig_test;
-  int * cha_signal;
-  int * chb_signal;
-  int ptr;
-  int i;
-
   // Set 'Trigger delay', number of data points to be acquired after trigger
   // to 0
   iface->GetOscilloscopeMemory()->posttriggertracelength = 0;
 
+  // Set Decimation to FPGA module, the count times are in samples
+  iface->GetOscilloscopeMemory()->decimation = decimation;
+
   // Reset Oscilloscope?
-  iface->GetOscilloscopeMemory()->configuration |= OSCRESETBIT;
+  iface->SetConfigurationBits(OSCRESETBIT);
 
   // Set Trigger Value (check for channel A / B)
   if(trigger == 2 || trigger == 3) { // Channel A
@@ -340,16 +1183,103 @@ void TriggeredAcquisition::Geiger(float length, MeasurementLengthType mlt) {
     std::cout << "Start main loop" << std::endl;
   }
 
+  // Count rate per interval, written while running
+  std::string ratefilename = filename + ".rate";
+  FILE * ratefile = fopen(ratefilename.c_str(), "w");
+  if(!ratefile) {
+    std::cout << "Error: Could not open " << ratefilename << std::endl;
+    return;
+  }
+  fprintf(ratefile, "# Count rate, %f s intervals, triggering on %s\n", rateinterval, triggerString(trigger).c_str());
+  fprintf(ratefile, "# <start [s]> <counts> <live time [s]> <rate [1/s]> <dead time corrected rate [1/s]>\n");
+  fflush(ratefile);
+  uint64_t interval = (uint64_t) (rateinterval * 1e9);
+  uint64_t intervalstart = 0;
+  uint64_t intervallive = 0;
+  int intervalcounts = 0;
+  // Adds the live time [from, to) (ns since start) to the intervals and
+  // writes the intervals completed before to
+  auto advance = [&](uint64_t from, uint64_t to) {
+    while(to >= intervalstart + interval) {
+      uint64_t end = intervalstart + interval;
+      if(from < end) {
+	intervallive += end - std::max(from, intervalstart);
+      }
+      fprintf(ratefile, "%f %d %f %f %f\n", intervalstart * 1e-9, intervalcounts, intervallive * 1e-9,
+	      intervalcounts / rateinterval, intervallive > 0 ? intervalcounts / (intervallive * 1e-9) : 0);
+      fflush(ratefile);
+      intervalstart = end;
+      intervallive = 0;
+      intervalcounts = 0;
+    }
+    if(to > from) {
+      intervallive += to - std::max(from, intervalstart);
+    }
+  };
+
+  volatile oscilloscope_mem * mem = iface->GetOscilloscopeMemory();
+  EventTiming t;
+  uint64_t lastcount = 0;
+  uint64_t livefrom = 0;
+  bool armed = false;
+  livetime = 0;
+  intervalhist.Reset();
   mulcount = 0;
+  profiler.Reset();
+  // Long gaps between counts are normal at background rates. Without a
+  // timeout from -W, waits only end every GEIGERWAITCHECK s to write the
+  // rate intervals and check the measurement time, the trigger stays armed
+  WaitSettings usersettings = waiter.GetSettings();
+  if(!waitexplicit) {
+    WaitSettings ws = usersettings;
+    ws.timeout = GEIGERWAITCHECK;
+    waiter.SetSettings(ws);
+  }
+  waiter.Prepare(iface);
   while(runcondition) {
     // Arm Trigger and set to Trigger method
-    iface->GetOscilloscopeMemory()->configuration |= TRIGGERARMBIT;
-    iface->GetOscilloscopeMemory()->trigger = trigger;
-
-    trig_test = iface->GetOscilloscopeMemory()->trigger;
-    while (trig_test!=0) {
-      trig_test = iface->GetOscilloscopeMemory()->trigger;
+    PROFILE_MARK(profiler);
+    iface->SetConfigurationBits(TRIGGERARMBIT);
+    mem->trigger = trigger;
+    std::chrono::high_resolution_clock::time_point armclock = std::chrono::high_resolution_clock::now();
+    uint32_t armwp = mem->writepointer;
+    t.armtime = std::chrono::duration_cast<std::chrono::nanoseconds>(armclock - starttime).count();
+    livefrom = t.armtime;
+    armed = true;
+    PROFILE_STAGE(profiler, STAGE_ARM);
+
+    bool counted = waiter.Wait(mem);
+    while(!counted && !waitexplicit) {
+      // Still armed and live
+      uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - starttime).count();
+      advance(livefrom, now);
+      livetime += now - livefrom;
+      livefrom = now;
+      if(mlt == LENGTH_IS_TIME && now * 1e-9 > length) {
+	break;
+      }
+      counted = waiter.Wait(mem);
+    }
+    if(!counted) {
+      if(waitexplicit) {
+	std::cout << "No count for more than " << waiter.GetSettings().timeout << " s - will stop now!" << std::endl;
+      }
+      break;
+    }
+    armed = false;
+    t.observedtime = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - starttime).count();
+    t.triggertime = TriggerSampleTime(t, armwp, mem->triggerpointer, 0);
+    PROFILE_STAGE(profiler, STAGE_WAIT);
+
+    // Live from arming to the count, the re-arm is dead time
+    advance(livefrom, t.triggertime);
+    livetime += t.triggertime - livefrom;
+    intervalcounts++;
+    if(runcount > 0) {
+      intervalhist.Fill((t.triggertime - lastcount) * 1e-3);
     }
+    lastcount = t.triggertime;
+    PROFILE_STAGE(profiler, STAGE_FORMAT);
     runcount++;
     if(mlt == LENGTH_IS_TIME) {
       clkDuration = std::chrono::duration_cast<millisec_t>(std::chrono::high_resolution_clock::now() - starttime);
@@ -363,13 +1293,46 @@ void TriggeredAcquisition::Geiger(float length, MeasurementLengthType mlt) {
       }
     }
   }
-  clkDuration = std::chrono::duration_cast<millisec_t>(std::chrono::high_resolution_clock::now() - starttime);
+  std::chrono::high_resolution_clock::time_point endtime = std::chrono::high_resolution_clock::now();
+  uint64_t end = std::chrono::duration_cast<std::chrono::nanoseconds>(endtime - starttime).count();
+  if(armed) {
+    // Armed until the end, still live time
+    advance(livefrom, end);
+    livetime += end - livefrom;
+  }
+  else {
+    advance(end, end);
+  }
+  // Last, shorter interval
+  if(end > intervalstart) {
+    double width = (end - intervalstart) * 1e-9;
+    fprintf(ratefile, "%f %d %f %f %f\n", intervalstart * 1e-9, intervalcounts, intervallive * 1e-9,
+	    intervalcounts / width, intervallive > 0 ? intervalcounts / (intervallive * 1e-9) : 0);
+  }
+  fclose(ratefile);
+
+  clkDuration = std::chrono::duration_cast<millisec_t>(endtime - starttime);
+  double realtime = clkDuration.count() / 1000;
+  double live = livetime * 1e-9;
+  runstats.events = runcount;
+  runstats.rejected = 0;
+  runstats.realtime = realtime;
+  runstats.livetime = live;
   std::cout << "Got  " << runcount << " counts in " << clkDuration.count()  << "ms (" << runcount / clkDuration.count() * 1000 << " counts/s)."<< std::endl;
+  std::cout << "Real time " << realtime << " s, live time " << live << " s, dead time corrected rate "
+	    << (live > 0 ? runcount / live : 0) << " counts/s." << std::endl;
+  waiter.Print();
+  waiter.SetSettings(usersettings);
   //    intfile.close();
 
-  fh = fopen("count.txt", "w");
-  fprintf(fh, "%d", runcount);
-  fclose(fh);
+  intervalhist.Save(filename + ".intervals", "Time between counts [us]", realtime, live);
+  std::cout << "Count rates written to " << ratefilename << ", times between counts to " << filename << ".intervals" << std::endl;
+  FILE * fh = fopen((filename + ".count").c_str(), "w");
+  if(fh) {
+    fprintf(fh, "%d", runcount);
+    fclose(fh);
+  }
+  DumpProfile("geiger");
 }
 
 void TriggeredAcquisition::SetRejectionParameters(float rmin, float rmax, int cstart, int cend) {
@@ -395,14 +1358,12 @@ void TriggeredAcquisition::SetRejectionParameters(float rmin, float rmax, int cs
 
 int TriggeredAcquisition::MeasureCalibrationA() {
   int trig_test;
-  int * cha_signal;
-  int * chb_signal;
   iface->GetOscilloscopeMemory()->posttriggertracelength = 16383;
 
   double total = 0;
   for(int runs = 0; runs < 100; runs++) {
     int totalrun = 0;
-    iface->GetOscilloscopeMemory()->configuration |= TRIGGERARMBIT;
+    iface->SetConfigurationBits(TRIGGERARMBIT);
     iface->GetOscilloscopeMemory()->trigger = 1; // Immediate Trigger for Calibration
     trig_test = iface->GetOscilloscopeMemory()->trigger;
     while (trig_test!=0) {
@@ -410,8 +1371,9 @@ int TriggeredAcquisition::MeasureCalibrationA() {
     }
     trig_ptr = iface->GetOscilloscopeMemory()->triggerpointer;
     signal_start_ptr = iface->GetOscilloscopeChannelA(); // FIX depending on measure 
+    ::ExtractTrace(signal_start_ptr, BUF, trig_ptr, 16383, tracebuf[0]);
     for (int i=0; i < 16383; i++) {
-      totalrun += signal_start_ptr[(trig_ptr+i)%BUF];
+      totalrun += RawSample(tracebuf[0][i]);
     }
     total += 1.0 * totalrun / 16383;
   }
@@ -424,15 +1386,13 @@ int TriggeredAcquisition::MeasureCalibrationA() {
 
 int TriggeredAcquisition::MeasureCalibrationB() {
   int trig_test;
-  int * cha_signal;
-  int * chb_signal;
   
   iface->GetOscilloscopeMemory()->posttriggertracelength = 16383;
 
   double total = 0;
   for(int runs = 0; runs < 100; runs++) {
     int totalrun = 0;
-    iface->GetOscilloscopeMemory()->configuration |= TRIGGERARMBIT;
+    iface->SetConfigurationBits(TRIGGERARMBIT);
     iface->GetOscilloscopeMemory()->trigger = 1; // Immediate Trigger for Calibration
     trig_test = iface->GetOscilloscopeMemory()->trigger;
     while (trig_test!=0) {
@@ -440,8 +1400,9 @@ int TriggeredAcquisition::MeasureCalibrationB() {
     }
     trig_ptr = iface->GetOscilloscopeMemory()->triggerpointer;
     signal_start_ptr = iface->GetOscilloscopeChannelB(); // FIX depending on measure 
+    ::ExtractTrace(signal_start_ptr, BUF, trig_ptr, 16383, tracebuf[0]);
     for (int i=0; i < 16383; i++) {
-      totalrun += signal_start_ptr[(trig_ptr+i)%BUF];
+      totalrun += RawSample(tracebuf[0][i]);
     }
     total += 1.0 * totalrun / 16383;
   }
@@ -452,114 +1413,483 @@ int TriggeredAcquisition::MeasureCalibrationB() {
   return (int) total;
 }
 
-inline void TriggeredAcquisition::WriteOffBinarySingle() {
-  int tracestart = trig_ptr - pretriggerlength;
+inline void TriggeredAcquisition::ExtractTrace(uint32_t * src, int trigptr, int16_t * dest) {
+  int tracestart = trigptr - pretriggerlength;
 
   if(tracestart < 0) {
     tracestart += BUF;
   }
+  ::ExtractTrace(src, BUF, tracestart, tracelength, dest);
+}
 
-  for (int i=0; i < tracelength; i++) {
-    datam[i] = signal_start_ptr[(tracestart+i)%BUF];
+inline void TriggeredAcquisition::ExtractEvent(int trigptr, int16_t * dest) {
+  // Traces of the recorded channels one after the other
+  for(int c = 0; c < nchannels; c++) {
+    ExtractTrace(measuresrc[c], trigptr, dest + c * tracelength);
   }
-  fwrite(datam, sizeof(int), tracelength, fh);
 }
 
+void TriggeredAcquisition::SelectChannels(uint32_t * a, uint32_t * b) {
+  nchannels = channel == CHANNEL_BOTH ? 2 : 1;
+  measuresrc[0] = channel == CHANNEL_B ? b : a;
+  measuresrc[1] = b;
+  channelstride = tracelength;
+  channelflags[0] = channel == CHANNEL_B ? INTEGRAL_CHANNEL_B : 0;
+  channelflags[1] = INTEGRAL_CHANNEL_B;
+  // The software trigger of captures looks at the trigger channel if it
+  // is recorded, else at the (only) recorded one
+  bool onB = (trigger == TRIG_B_POS_EDGE || trigger == TRIG_B_NEG_EDGE);
+  discslot = (channel == CHANNEL_BOTH && onB) ? 1 : 0;
+}
 
-inline void TriggeredAcquisition::WriteOffAsciiSingle() {
-  int tracestart = trig_ptr - pretriggerlength;
-  
-  if(tracestart < 0) {
-    tracestart += BUF;
+int TriggeredAcquisition::WriteOffCapture(int16_t * window, int maxevents, int & discarded) {
+  // The first event is at the hardware trigger, further ones are found
+  // by the software trigger; each must fit completely into the capture
+  int n = pretriggerlength + capturelength;
+  double nspersample = 1e9 * decimation / ADCSAMPLERATE;
+  uint64_t triggertime = timing.triggertime;
+  bool burstmode = (acquisition == ACQ_BURST);
+  bool beyond = true;
+  int events = 0;
+  int pos = pretriggerlength;
+  int last = n - tracelength + pretriggerlength;
+  int16_t * disc = window + discslot * BUF;
+  // Captures of the channels are BUF samples apart
+  channelstride = BUF;
+  while(events < maxevents && pos <= last) {
+    trace = window + pos - pretriggerlength;
+    timing.triggertime = triggertime + (uint64_t) ((pos - pretriggerlength) * nspersample);
+    if(CoincidenceTest(window + coincslot * BUF, n, pos)) {
+      if(burstmode) {
+	int16_t * slot = burst.Next();
+	if(!slot) {
+	  break;
+	}
+	for(int c = 0; c < nchannels; c++) {
+	  memcpy(slot + c * tracelength, trace + c * BUF, tracelength * sizeof(int16_t));
+	}
+	burst.Push(timing);
+	PROFILE_STAGE(profiler, STAGE_COPY);
+      }
+      else if(!WriteOff()) {
+	discarded++;
+      }
+      events++;
+    }
+
+    // Live again after the holdoff, until the next event or the last
+    // position where a complete trace fits
+    pos += dischold;
+    if(pos > last) {
+      break;
+    }
+    int r = FindCrossing(disc + pos, n - pos, discthreshold, discrising, beyond);
+    PROFILE_STAGE(profiler, STAGE_SEARCH);
+    if(r < 0 || pos + r > last) {
+      livetime += (uint64_t) ((last - pos) * nspersample);
+      break;
+    }
+    livetime += (uint64_t) (r * nspersample);
+    pos += r;
   }
-  for (int i=0; i < tracelength; i++) {
-    fprintf(fh, "%d ", signal_start_ptr[(tracestart+i)%BUF]);
+  channelstride = tracelength;
+  return events;
+}
+
+uint64_t TriggeredAcquisition::TriggerSampleTime(const EventTiming & t, uint32_t armwp, uint32_t trigptr, int posttrigger) {
+  // Samples written from arming to the trigger: the position in the ring
+  // comes from the pointers, full laps are estimated from the time until
+  // the trigger was observed (after the post trigger samples)
+  double nspersample = 1e9 * decimation / ADCSAMPLERATE;
+  uint32_t offset = (trigptr % BUF + BUF - armwp % BUF) % BUF;
+  double elapsed = (t.observedtime - t.armtime) / nspersample - posttrigger;
+  double laps = std::floor((elapsed - offset) / BUF + 0.5);
+  if(laps < 0) {
+    laps = 0;
   }
-  fprintf(fh, "\n");
+  uint64_t triggertime = t.armtime + (uint64_t) ((offset + laps * BUF) * nspersample);
+  return triggertime < t.observedtime ? triggertime : t.observedtime;
 }
 
-inline bool TriggeredAcquisition::WriteOffAsciiIntegral() {
-  int tracestart = trig_ptr - pretriggerlength;
-  
-  if(tracestart < 0) {
-    tracestart += BUF;
+inline void TriggeredAcquisition::CountRate() {
+  if(timing.triggertime >= ratewindowstart + RATEWINDOW) {
+    if(ratecount > ratepeak) {
+      ratepeak = ratecount;
+    }
+    ratewindowstart = timing.triggertime - timing.triggertime % RATEWINDOW;
+    ratecount = 0;
   }
-  double baseline = 0;
-  double total = 0;
+  ratecount++;
+}
+
+inline bool TriggeredAcquisition::WriteOff() {
+  // Write Data with the pipeline selected for the run (SelectWriteOff()),
+  // returns false if event was rejected
+  CountRate();
+  return (this->*writeofffn)();
+}
+
+template<WriteOffSetting MODE, int LENGTH>
+bool TriggeredAcquisition::WriteOffEvent() {
+  // MODE and (if not 0) LENGTH are constants, the branches fold away and
+  // the per sample loops get a fixed trip count
+  const int n = LENGTH > 0 ? LENGTH : tracelength;
+  switch(MODE) {
+  case WRITE_OFF_BINARY_SINGLE:
+    WriteOffBinarySingle(n);
+    return true;
+  case WRITE_OFF_BINARY_MUL:
+    WriteOffBinaryMul(n);
+    return true;
+  case WRITE_OFF_BINARY_TRACE:
+    WriteOffBinaryTrace(n);
+    return true;
+  case WRITE_OFF_ASCII_SINGLE:
+    WriteOffAsciiSingle(n);
+    return true;
+  case WRITE_OFF_ASCII_INTEGRAL:
+    return WriteOffAsciiIntegral(n);
+  case WRITE_OFF_JUST_CHECK:
+    WriteOffJustCheck(n);
+    return true;
+  case WRITE_OFF_BINARY_INTEGRAL:
+    return WriteOffBinaryIntegral(n);
+  case WRITE_OFF_HISTOGRAM:
+    return WriteOffHistogram(n);
+  }
+  return true;
+}
+
+template<WriteOffSetting MODE>
+TriggeredAcquisition::WriteOffFunction TriggeredAcquisition::SelectTraceLength() {
+  // Common trace lengths get their own instance
+  switch(tracelength) {
+  case 256:
+    return &TriggeredAcquisition::WriteOffEvent<MODE, 256>;
+  case 384:
+    return &TriggeredAcquisition::WriteOffEvent<MODE, 384>;
+  case 1024:
+    return &TriggeredAcquisition::WriteOffEvent<MODE, 1024>;
+  }
+  return &TriggeredAcquisition::WriteOffEvent<MODE, 0>;
+}
+
+void TriggeredAcquisition::SelectWriteOff() {
+  switch(writeoff) {
+  case WRITE_OFF_ASCII_SINGLE:
+    writeofffn = SelectTraceLength<WRITE_OFF_ASCII_SINGLE>();
+    break;
+  case WRITE_OFF_BINARY_SINGLE:
+    writeofffn = SelectTraceLength<WRITE_OFF_BINARY_SINGLE>();
+    break;
+  case WRITE_OFF_BINARY_TRACE:
+    writeofffn = SelectTraceLength<WRITE_OFF_BINARY_TRACE>();
+    break;
+  case WRITE_OFF_BINARY_MUL:
+    writeofffn = SelectTraceLength<WRITE_OFF_BINARY_MUL>();
+    break;
+  case WRITE_OFF_ASCII_INTEGRAL:
+    writeofffn = SelectTraceLength<WRITE_OFF_ASCII_INTEGRAL>();
+    break;
+  case WRITE_OFF_JUST_CHECK:
+    writeofffn = SelectTraceLength<WRITE_OFF_JUST_CHECK>();
+    break;
+  case WRITE_OFF_BINARY_INTEGRAL:
+    writeofffn = SelectTraceLength<WRITE_OFF_BINARY_INTEGRAL>();
+    break;
+  case WRITE_OFF_HISTOGRAM:
+    writeofffn = SelectTraceLength<WRITE_OFF_HISTOGRAM>();
+    break;
+  }
+  if(nchannels > 1) {
+    channelfn = writeofffn;
+    writeofffn = &TriggeredAcquisition::WriteOffChannels;
+  }
+
   // Set Start / End for Peak test, based on default values or settings
-  int startp = pretriggerlength;
-  int endp = tracelength;
+  peakstart = pretriggerlength;
+  peakend = tracelength;
   if(channelstart != -1) {
-    startp = channelstart;
-    endp = channelend;
+    peakstart = channelstart;
+    peakend = channelend;
   }
-  int peak = 0;
-  for (int i=0; i < tracelength; i++) {
-    int signal = 0;
-    if(signal_start_ptr[(tracestart+i)%BUF] >= 8192) {
-      signal = signal_start_ptr[(tracestart+i)%BUF] - 16384;
-    }
-    else {
-      signal = signal_start_ptr[(tracestart+i)%BUF];
-    }
-    if(i < 25) {
-      baseline += signal;
-    }
-    if(i >= startp and i <= endp and abs(signal) > peak) {
-	peak = abs(signal);
+}
+
+bool TriggeredAcquisition::WriteOffChannels() {
+  // Every trace of the event through the pipeline, A before B; the event
+  // counts as rejected if one of them is
+  int16_t * first = trace;
+  bool accepted = true;
+  for(channelslot = 0; channelslot < nchannels; channelslot++) {
+    trace = first + channelslot * channelstride;
+    if(!(this->*channelfn)()) {
+      accepted = false;
     }
-    total += signal;
   }
-  total -= tracelength * baseline / 25.0;
-  peak -= abs(baseline / 25.0);
-  if(verboseLevel > 1) {
-    std::cout << "Total" << total << " Peak:" << peak <<" base: " << baseline << std::endl;
+  channelslot = 0;
+  trace = first;
+  return accepted;
+}
+
+inline void TriggeredAcquisition::WriteOffBinarySingle(int n) {
+  int * dest = (int *) out.Reserve(n * sizeof(int));
+  for (int i=0; i < n; i++) {
+    dest[i] = RawSample(trace[i]);
   }
-  if(abs(total) >= peak * ratiomin and abs(total) <= peak * ratiomax) {
-    fprintf(fh, "%f\n", total);
-    return true;
+  PROFILE_STAGE(profiler, STAGE_FORMAT);
+  out.Commit(n * sizeof(int));
+  PROFILE_STAGE(profiler, STAGE_WRITE);
+}
+
+
+inline void TriggeredAcquisition::WriteOffBinaryMul(int n) {
+  int * dest = datamb + mulcount * n;
+  for (int i=0; i < n; i++) {
+    dest[i] = RawSample(trace[i]);
+  }
+  mulcount++;
+  PROFILE_STAGE(profiler, STAGE_FORMAT);
+  if(mulcount == mulbatch) {
+    FlushMul();
+  }
+  PROFILE_STAGE(profiler, STAGE_WRITE);
+}
+
+void TriggeredAcquisition::FlushMul() {
+  // Same file content as WriteOffBinarySingle, one fwrite per batch
+  if(mulcount > 0) {
+    out.Write(datamb, sizeof(int) * mulcount * tracelength);
+  }
+  mulcount = 0;
+}
+
+inline void TriggeredAcquisition::WriteOffBinaryTrace(int n) {
+  if(blockbytes + n * MAXENCODEDSAMPLE > TRACEBLOCKBUF) {
+    FlushTraceBlock();
+  }
+  PROFILE_STAGE(profiler, STAGE_WRITE);
+  blockbytes += EncodeTrace(trace, n, blockbuf + blockbytes);
+  blocktraces++;
+  PROFILE_STAGE(profiler, STAGE_FORMAT);
+}
+
+void TriggeredAcquisition::FlushTraceBlock() {
+  if(blocktraces > 0) {
+    TraceBlockHeader block;
+    block.magic = TRACEBLOCKMAGIC;
+    block.bytes = blockbytes;
+    block.traces = blocktraces;
+    block.samples = blocktraces * tracelength;
+    out.Write(&block, sizeof(block));
+    out.Write(blockbuf, blockbytes);
   }
-  else if(peak <= curvebend and abs(total) <= peak * ratiomax) {
-    fprintf(fh, "%f\n", total);
+  blockbytes = 0;
+  blocktraces = 0;
+}
+
+inline void TriggeredAcquisition::WriteOffAsciiSingle(int n) {
+  // Same text as fprintf "%d " per sample, rendered in place
+  char * text = out.Reserve(n * MAXTEXTSAMPLE + 1);
+  int length = FormatTrace(trace, n, text);
+  PROFILE_STAGE(profiler, STAGE_FORMAT);
+  out.Commit(length);
+  PROFILE_STAGE(profiler, STAGE_WRITE);
+}
+
+inline bool TriggeredAcquisition::Integrate(int n, TraceIntegral & ti, double & total, int & peak) {
+  // Peak window from SelectWriteOff()
+  IntegrateTrace(trace, n, BASELINELENGTH, peakstart, peakend, ti);
+  PROFILE_STAGE(profiler, STAGE_INTEGRATE);
+  SubtractBaseline(ti, n, BASELINELENGTH, total, peak);
+  if(verboseLevel > 1) {
+    std::cout << "Total" << total << " Peak:" << peak <<" base: " << ti.baseline << std::endl;
+  }
+  bool accepted = AcceptPulse(total, peak, ratiomin, ratiomax, curvebend);
+  PROFILE_STAGE(profiler, STAGE_REJECT);
+  return accepted;
+}
+
+inline bool TriggeredAcquisition::WriteOffAsciiIntegral(int n) {
+  TraceIntegral ti;
+  double total;
+  int peak;
+  if(Integrate(n, ti, total, peak)) {
+    char * text = out.Reserve(MAXTEXTFIXED + 3);
+    char * p = FormatFixed(text, total);
+    if(nchannels > 1) {
+      *p++ = ' ';
+      *p++ = channelslot == 0 ? 'A' : 'B';
+    }
+    *p++ = '\n';
+    PROFILE_STAGE(profiler, STAGE_FORMAT);
+    out.Commit(p - text);
+    PROFILE_STAGE(profiler, STAGE_WRITE);
     return true;
   }
   return false;
 }
 
-inline void TriggeredAcquisition::WriteOffJustCheck() {
-  int tracestart = trig_ptr - pretriggerlength;
-  
-  if(tracestart < 0) {
-    tracestart += BUF;
+inline bool TriggeredAcquisition::WriteOffBinaryIntegral(int n) {
+  // All events are stored, rejected ones are flagged
+  TraceIntegral ti;
+  double total;
+  int peak;
+  bool accepted = Integrate(n, ti, total, peak);
+
+  IntegralRecord & rec = records[recordcount];
+  rec.integral = total;
+  rec.timestamp = timing.triggertime;
+  rec.peak = peak;
+  rec.baseline = ti.baseline;
+  rec.peakpos = ti.peakpos;
+  rec.flags = (accepted ? 0 : INTEGRAL_REJECTED) | channelflags[channelslot];
+  rec.armtime = timing.armtime;
+  rec.observedtime = timing.observedtime;
+  recordcount++;
+  PROFILE_STAGE(profiler, STAGE_FORMAT);
+  if(recordcount == RECORDBUF) {
+    FlushRecords();
   }
-  double baseline = 0;
-  double total = 0;
-  // Set Start / End for Peak test, based on default values or settings
-  int startp = pretriggerlength;
-  int endp = tracelength;
-  int peak = 0;
-  int peakposition = 0;
-  for (int i=0; i < tracelength; i++) {
-    int signal = 0;
-    if(signal_start_ptr[(tracestart+i)%BUF] >= 8192) {
-      signal = signal_start_ptr[(tracestart+i)%BUF] - 16384;
-    }
-    else {
-      signal = signal_start_ptr[(tracestart+i)%BUF];
+  PROFILE_STAGE(profiler, STAGE_WRITE);
+  return accepted;
+}
+
+inline bool TriggeredAcquisition::WriteOffHistogram(int n) {
+  TraceIntegral ti;
+  double total;
+  int peak;
+  bool accepted = Integrate(n, ti, total, peak);
+  if(accepted) {
+    inthist[channelslot].Fill(fabs(total));
+    if(histpeak) {
+      peakhist[channelslot].Fill(peak);
     }
-    if(i < 25) {
-      baseline += signal;
+  }
+  PROFILE_STAGE(profiler, STAGE_FORMAT);
+  if(timing.triggertime >= nextsnapshot) {
+    Snapshot();
+    nextsnapshot = timing.triggertime + (uint64_t) (snapshotinterval * 1e9);
+    PROFILE_STAGE(profiler, STAGE_WRITE);
+  }
+  return accepted;
+}
+
+void TriggeredAcquisition::Snapshot() {
+  // Spectra are copied and written by a separate thread, acquisition
+  // continues meanwhile
+  if(snapshotbusy) {
+    snapshotsskipped++;
+    return;
+  }
+  if(snapshotthread.joinable()) {
+    snapshotthread.join();
+  }
+  for(int c = 0; c < nchannels; c++) {
+    snapint[c].CopyFrom(inthist[c]);
+    if(histpeak) {
+      snappeak[c].CopyFrom(peakhist[c]);
     }
-    if(abs(signal) > peak) {
-	peak = abs(signal);
-	peakposition = i;
+  }
+  double realtime = timing.triggertime * 1e-9;
+  double live = livetime * 1e-9;
+  snapshotbusy = true;
+  snapshotthread = std::thread([this, realtime, live]() {
+      SaveSpectra(snapint, snappeak, realtime, live);
+      snapshotbusy = false;
+    });
+}
+
+void TriggeredAcquisition::SaveSpectra(Histogram * hint, Histogram * hpeak, double realtime, double live) {
+  for(int c = 0; c < nchannels; c++) {
+    hint[c].Save(SpectrumName(c, ".spectrum"), "Integral spectrum, baseline subtracted", realtime, live);
+    if(histpeak) {
+      hpeak[c].Save(SpectrumName(c, ".peaks"), "Peak amplitude spectrum, baseline subtracted", realtime, live);
     }
-    total += signal;
   }
-  total -= tracelength * baseline / 25.0;
-  peak -= abs(baseline / 25.0);
+}
+
+std::string TriggeredAcquisition::SpectrumName(int slot, std::string suffix) {
+  // <filename>.A.spectrum and <filename>.B.spectrum if both channels are recorded
+  if(nchannels > 1) {
+    return filename + (slot == 0 ? ".A" : ".B") + suffix;
+  }
+  return filename + suffix;
+}
+
+void TriggeredAcquisition::WriteRunFooter(int events, int rejected, double realtime) {
+  RunFooter footer;
+  memset(&footer, 0, sizeof(footer));
+  strncpy(footer.magic, RUNFOOTERMAGIC, sizeof(footer.magic));
+  footer.events = events;
+  footer.rejected = rejected;
+  footer.realtime = realtime;
+  footer.livetime = livetime * 1e-9;
+  footer.deadfraction = realtime > 0 ? 1 - footer.livetime / realtime : 0;
+  out.Write(&footer, sizeof(footer));
+}
+
+void TriggeredAcquisition::PrepareRealtime() {
+  // After OpenOutput(): lock, then fault in everything the loop touches
+  realtime.Prepare();
+  RealtimeProfile::Prefault(data, sizeof(data));
+  RealtimeProfile::Prefault(peakpos, sizeof(peakpos));
+  RealtimeProfile::Prefault(datamb, mulalloc * sizeof(int));
+  for(int i = 0; i < 2; i++) {
+    RealtimeProfile::Prefault(tracebuf[i], 2 * BUF * sizeof(int16_t));
+  }
+  RealtimeProfile::Prefault(records, RECORDBUF * sizeof(IntegralRecord));
+  RealtimeProfile::Prefault(blockbuf, TRACEBLOCKBUF);
+  for(int c = 0; c < 2; c++) {
+    RealtimeProfile::Prefault(inthist[c].GetCounts(), inthist[c].GetBins() * sizeof(uint32_t));
+    RealtimeProfile::Prefault(peakhist[c].GetCounts(), peakhist[c].GetBins() * sizeof(uint32_t));
+  }
+  if(out.IsOpen()) {
+    // Not for the output methods without a file (5, 7)
+    out.Prefault();
+  }
+  const RealtimeSettings & rs = realtime.GetSettings();
+  std::cout << "Real-time acquisition loop: core " << rs.core << ", SCHED_FIFO priority " << rs.priority << ", buffers prefaulted" << std::endl;
+}
+
+void TriggeredAcquisition::FinishRealtime() {
+  realtime.Print();
+  if(realtime.GetCount() > 0 && realtime.Save(filename + ".jitter")) {
+    std::cout << "Loop jitter histogram written to " << filename << ".jitter" << std::endl;
+  }
+  realtime.Finish();
+}
+
+void TriggeredAcquisition::DumpProfile(const std::string & run) {
+#ifdef IBX_PROFILING
+  profiler.Print();
+  if(profiler.SaveJSON(filename + ".latency.json", run)) {
+    std::cout << "Stage latencies written to " << filename << ".latency.json" << std::endl;
+  }
+#else
+  (void) run;
+#endif
+}
+
+void TriggeredAcquisition::FlushRecords() {
+  if(recordcount > 0) {
+    out.Write(records, sizeof(IntegralRecord) * recordcount);
+  }
+  recordcount = 0;
+}
+
+inline void TriggeredAcquisition::WriteOffJustCheck(int n) {
+  // Peak is searched in the whole trace
+  TraceIntegral ti;
+  IntegrateTrace(trace, n, BASELINELENGTH, 0, n, ti);
+  double baseline = ti.baseline;
+  double total = ti.total;
+  int peak = ti.peak;
+  int peakposition = ti.peakpos;
+  total -= n * baseline / BASELINELENGTH;
+  peak -= abs(baseline / BASELINELENGTH);
   avgintegpeak += 1.0 * total / peak;
   peakpos[peakposition] += 1;
+  PROFILE_STAGE(profiler, STAGE_INTEGRATE);
 }
 
 void TriggeredAcquisition::SetDecimation(int dec) {
@@ -639,10 +1969,162 @@ void TriggeredAcquisition::SetWriteOff(WriteOffSetting ws) {
   writeoff = ws;
 }
 
+void TriggeredAcquisition::SetAcquisition(AcquisitionSetting as) {
+  acquisition = as;
+}
+
+void TriggeredAcquisition::SetChannel(ChannelSetting cs) {
+  channel = cs;
+}
+
+void TriggeredAcquisition::SetCoincidence(CoincidenceSetting cs, int window, int threshold) {
+  if(window < 0 || window > BUF / 2) {
+    std::cout << "Error: Coincidence window must be between 0 and " << BUF / 2 << " samples." << std::endl;
+  }
+  else if(threshold < -8192 || threshold > 8191) {
+    std::cout << threshold << " is not allowed as coincidence threshold (-8192 to 8191)" << std::endl;
+  }
+  else {
+    coincidence = cs;
+    coincwindow = window;
+    coincthreshold = threshold;
+  }
+}
+
+void TriggeredAcquisition::SetRingSlots(int n) {
+  if(n > 0) {
+    ringslots = n;
+  }
+}
+
+void TriggeredAcquisition::SetHoldoff(int samples) {
+  if(samples >= 0 && samples <= BUF) {
+    holdoff = samples;
+  }
+  else {
+    std::cout << "Error: Holdoff must be between 0 and " << BUF << " samples." << std::endl;
+  }
+}
+
+void TriggeredAcquisition::SetCaptureLength(int samples) {
+  if(samples >= 0 && samples <= 16383) {
+    capturelength = samples;
+  }
+  else {
+    std::cout << "Error: Capture length must be between 0 (off) and 16383 samples." << std::endl;
+  }
+}
+
+void TriggeredAcquisition::SetBurstMemory(int megabytes) {
+  if(megabytes > 0) {
+    burstmemory = megabytes;
+  }
+  else {
+    std::cout << "Error: Memory for burst capture must be at least 1 MB." << std::endl;
+  }
+}
+
+void TriggeredAcquisition::SetWaitSettings(const WaitSettings & ws) {
+  if(ws.strategy < WAIT_SPIN || ws.strategy > WAIT_INTERRUPT) {
+    std::cout << "Error: Not a valid trigger wait strategy." << std::endl;
+  }
+  else if(ws.spinpolls < 0 || ws.minsleep < 0 || ws.maxsleep < ws.minsleep) {
+    std::cout << "Error: Spin polls and sleep times must not be negative, the longest sleep not below the first." << std::endl;
+  }
+  else if(ws.timeout < 0) {
+    std::cout << "Error: Trigger timeout must not be negative." << std::endl;
+  }
+  else {
+    waiter.SetSettings(ws);
+    waitexplicit = true;
+  }
+}
+
+void TriggeredAcquisition::SetRealtimeSettings(const RealtimeSettings & rs) {
+  if(rs.core < -1) {
+    std::cout << "Error: Core of the acquisition loop must be -1 (any) or a core number." << std::endl;
+  }
+  else if(rs.priority < 0 || rs.priority > sched_get_priority_max(SCHED_FIFO)) {
+    std::cout << "Error: SCHED_FIFO priority must be between 0 (keep scheduler) and " << sched_get_priority_max(SCHED_FIFO) << "." << std::endl;
+  }
+  else {
+    realtime.SetSettings(rs);
+  }
+}
+
+void TriggeredAcquisition::SetMulBatch(int n) {
+  if(n > 0) {
+    mulbatch = n;
+  }
+  else {
+    std::cout << "Error: Batch size must be at least one trace." << std::endl;
+  }
+}
+
+void TriggeredAcquisition::SetWriterSettings(const WriterSettings & ws) {
+  if(ws.buffersize < WRITERALIGN || ws.buffersize % WRITERALIGN != 0) {
+    std::cout << "Error: Output buffer size must be a multiple of " << WRITERALIGN / 1024 << " kB." << std::endl;
+  }
+  else if(ws.buffers < 2) {
+    std::cout << "Error: At least two output buffers are needed." << std::endl;
+  }
+  else if(ws.syncinterval < 0) {
+    std::cout << "Error: Sync interval must not be negative." << std::endl;
+  }
+  else {
+    out.SetSettings(ws);
+  }
+}
+
+void TriggeredAcquisition::SetHistogram(int bins, double min, double max) {
+  inthist[0].SetBinning(bins, min, max);
+  inthist[1].SetBinning(bins, min, max);
+}
+
+void TriggeredAcquisition::SetPeakHistogram(bool on) {
+  histpeak = on;
+  peakhist[0].SetBinning(inthist[0].GetBins(), 0, 8192);
+  peakhist[1].SetBinning(inthist[1].GetBins(), 0, 8192);
+}
+
+void TriggeredAcquisition::SetSnapshotInterval(double s) {
+  if(s > 0) {
+    snapshotinterval = s;
+  }
+}
+
+void TriggeredAcquisition::SetRateInterval(double s) {
+  if(s > 0) {
+    rateinterval = s;
+  }
+  else {
+    std::cout << "Error: Rate interval must be positive." << std::endl;
+  }
+}
+
+void TriggeredAcquisition::SetIntervalHistogram(int bins, double max) {
+  if(bins > 0 && max > 0) {
+    intervalhist.SetBinning(bins, 0, max);
+  }
+  else {
+    std::cout << "Error: Histogram of times between counts needs at least one bin and a positive range." << std::endl;
+  }
+}
+
 void TriggeredAcquisition::SetFilename(std::string filen) {
   filename = filen;
 }
 
+void TriggeredAcquisition::SetInterface(FPGAInterface * fi) {
+  // Takes ownership, must be called before Init()
+  if(initialized) {
+    std::cout << "Error: Cannot change FPGA interface after initialization." << std::endl;
+    return;
+  }
+  delete iface;
+  iface = fi;
+}
+
 
 void TriggeredAcquisition::DumpSettings() {
   std::cout << std::endl;
@@ -653,7 +2135,16 @@ void TriggeredAcquisition::DumpSettings() {
   //std::cout << "Trigger Voltage:      " << triggervoltage << " Volt" << std::endl;
   std::cout << "Trigger Value:            " << triggervalue << std::endl; 
   std::cout << "Triggering on:            " << triggerString(trigger) << std::endl;
-  if (writeoff == WRITE_OFF_ASCII_INTEGRAL) { 
+  std::cout << "Acquisition method:       " << acquisition << std::endl;
+  std::cout << "Recorded channels:        " << channelString(channel) << std::endl;
+  if(realtime.IsEnabled()) {
+    std::cout << "Real-time loop:           core " << realtime.GetSettings().core << ", priority " << realtime.GetSettings().priority << std::endl;
+  }
+  if(coincidence != COINC_OFF) {
+    std::cout << "Coincidence filter:       " << (coincidence == COINC_REQUIRE ? "coincidence" : "anti-coincidence")
+	      << ", " << coincwindow << " samples, channel B threshold " << coincthreshold << std::endl;
+  }
+  if (writeoff == WRITE_OFF_ASCII_INTEGRAL || writeoff == WRITE_OFF_BINARY_INTEGRAL || writeoff == WRITE_OFF_HISTOGRAM) { 
     std::cout << "Rejection Parameter <min> " << ratiomin << std::endl;
     std::cout << "Rejection Parameter <max> " << ratiomax << std::endl;
     std::cout << "Rejection Parameter <s>   " << channelstart << std::endl;
@@ -673,4 +2164,28 @@ std::string TriggeredAcquisition::triggerString(TriggerSetting ts) {
   case TRIG_EXTERNAL_0: return "External trigger, port 0";
   case TRIG_EXTERNAL_1: return "External trigger, port 1";
   }
+  return "Unknown";
+}
+
+std::string TriggeredAcquisition::textHeader(int decimation, int tracelength, int pretriggerlength,
+					     int triggervalue, TriggerSetting trigger) {
+  std::string triggers = triggerString(trigger);
+  char buf[256];
+  snprintf(buf, sizeof(buf),
+	   "Decimation:           %d\n"
+	   "Trace length:         %d\n"
+	   "Pretrigger length:    %d\n"
+	   "Trigger Value:        %f\n"
+	   "Triggering on:        %s\n",
+	   decimation, tracelength, pretriggerlength, (double) triggervalue, triggers.c_str());
+  return buf;
+}
+
+std::string TriggeredAcquisition::channelString(ChannelSetting cs) {
+  switch(cs){
+  case CHANNEL_A: return "Channel A";
+  case CHANNEL_B: return "Channel B";
+  case CHANNEL_BOTH: return "Channel A and B";
+  }
+  return "Unknown";
 }
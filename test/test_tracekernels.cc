@@ -0,0 +1,183 @@
+/*
+ * acquisition - RedPitaya Data Acquisition
+ *
+ *
+ * Copyright (C) 2016, 2017 Moritz Kütt, Malte Göttsche, Alexander Glaser
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: moritz@nuclearfreesoftware.org
+ */
+
+// Checks that the wide trace kernels return exactly the same results as
+// their scalar references, on randomized traces, windows and thresholds.
+
+#include <iostream>
+#include <random>
+#include <vector>
+#include <stdint.h>
+
+#include "TraceKernels.hh"
+
+static std::mt19937 rng(20170101);
+static int failures = 0;
+
+static int Uniform(int lo, int hi) {
+  return std::uniform_int_distribution<int>(lo, hi)(rng);
+}
+
+// Random 14-bit signal: either noise around a baseline or a pulse on top
+// of it, with full scale samples now and then
+static void RandomTrace(std::vector<int16_t> & trace) {
+  int lo = -(1 << (ADCBITS - 1));
+  int hi = (1 << (ADCBITS - 1)) - 1;
+  int baseline = Uniform(-200, 200);
+  int amplitude = Uniform(-8000, 8000);
+  int pos = Uniform(0, trace.size());
+  for(size_t i = 0; i < trace.size(); i++) {
+    int v = baseline + Uniform(-20, 20);
+    if((int) i >= pos) {
+      v += amplitude / (1 + ((int) i - pos) / 16);
+    }
+    if(Uniform(0, 200) == 0) {
+      v = Uniform(0, 1) ? lo : hi;
+    }
+    trace[i] = v < lo ? lo : (v > hi ? hi : v);
+  }
+}
+
+static void Check(bool ok, const char * what, int n, int a, int b) {
+  if(!ok) {
+    failures++;
+    if(failures <= 20) {
+      std::cout << "FAIL " << what << " n=" << n << " " << a << " " << b << std::endl;
+    }
+  }
+}
+
+static void TestIntegrate(const int16_t * trace, int n, int bl, int ps, int pe) {
+  TraceIntegral wide, ref;
+  IntegrateTrace(trace, n, bl, ps, pe, wide);
+  IntegrateTraceScalar(trace, n, bl, ps, pe, ref);
+  bool ok = wide.baseline == ref.baseline && wide.total == ref.total
+    && wide.peak == ref.peak && wide.peakpos == ref.peakpos;
+  Check(ok, "IntegrateTrace", n, ps, pe);
+}
+
+static void TestIntegrateTrace() {
+  for(int iter = 0; iter < 20000; iter++) {
+    int n = Uniform(0, 600);
+    // Offset into the buffer, so the kernels also see unaligned traces
+    int offset = Uniform(0, 7);
+    std::vector<int16_t> buf(n + offset);
+    RandomTrace(buf);
+    const int16_t * trace = &buf[0] + offset;
+    int bl = Uniform(0, 3) == 0 ? BASELINELENGTH : Uniform(0, n + 10);
+    int ps, pe;
+    switch(Uniform(0, 4)) {
+    case 0: // whole trace
+      ps = 0;
+      pe = n - 1;
+      break;
+    case 1: // window at the trace edges or beyond
+      ps = Uniform(-10, 0);
+      pe = Uniform(n - 2, n + 10);
+      break;
+    case 2: // empty window
+      ps = Uniform(0, n + 5);
+      pe = ps - Uniform(1, 5);
+      break;
+    case 3: // single sample
+      ps = pe = Uniform(-1, n);
+      break;
+    default:
+      ps = Uniform(-5, n + 5);
+      pe = Uniform(ps, n + 5);
+    }
+    TestIntegrate(trace, n, bl, ps, pe);
+  }
+}
+
+// Runs the wide and the scalar discriminator over the same samples in
+// chunks of random length, carrying beyond from one call to the next
+template <typename T>
+static void TestCrossings(const std::vector<T> & src, int threshold, bool rising) {
+  int n = src.size();
+  bool bw = Uniform(0, 1) != 0;
+  bool br = bw;
+  int pos = 0;
+  while(pos < n) {
+    int len = Uniform(0, 3) == 0 ? n - pos : Uniform(1, 80);
+    if(len > n - pos) {
+      len = n - pos;
+    }
+    int w = FindCrossing(&src[pos], len, threshold, rising, bw);
+    int r = FindCrossingScalar(&src[pos], len, threshold, rising, br);
+    Check(w == r && bw == br, "FindCrossing", len, w, r);
+    if(w != r) {
+      return;
+    }
+    pos += w >= 0 ? w + 1 : len;
+  }
+}
+
+static void TestFindCrossing() {
+  for(int iter = 0; iter < 5000; iter++) {
+    int n = Uniform(1, 1000);
+    std::vector<int16_t> samples(n);
+    RandomTrace(samples);
+    std::vector<uint32_t> raw(n);
+    for(int i = 0; i < n; i++) {
+      raw[i] = RawSample(samples[i]);
+    }
+    bool rising = Uniform(0, 1) != 0;
+    int threshold;
+    if(Uniform(0, 4) == 0) {
+      // Threshold equal to a sample, to test the >= and <= edges
+      threshold = samples[Uniform(0, n - 1)];
+    }
+    else {
+      threshold = Uniform(-3000, 3000);
+    }
+    TestCrossings(samples, threshold, rising);
+    TestCrossings(raw, threshold, rising);
+  }
+}
+
+static void TestExtractSpan() {
+  for(int iter = 0; iter < 2000; iter++) {
+    int n = Uniform(0, 300);
+    std::vector<uint32_t> raw(n + 1);
+    for(int i = 0; i < n; i++) {
+      // Upper bits set as on the FPGA bus, only the low 14 bits count
+      raw[i] = (uint32_t) rng();
+    }
+    std::vector<int16_t> wide(n + 1), ref(n + 1);
+    ExtractSpan(&raw[0], n, &wide[0]);
+    ExtractSpanScalar(&raw[0], n, &ref[0]);
+    Check(wide == ref, "ExtractSpan", n, 0, 0);
+  }
+}
+
+int main() {
+  TestIntegrateTrace();
+  TestFindCrossing();
+  TestExtractSpan();
+  if(failures > 0) {
+    std::cout << failures << " mismatches between wide and scalar kernels" << std::endl;
+    return 1;
+  }
+  std::cout << "Trace kernels match the scalar references" << std::endl;
+  return 0;
+}
@@ -0,0 +1,212 @@
+/*
+ * acquisition - RedPitaya Data Acquisition
+ *
+ *
+ * Copyright (C) 2016, 2017 Moritz Kütt, Malte Göttsche, Alexander Glaser
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact: moritz@nuclearfreesoftware.org
+ */
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <stdint.h>
+
+#include "TriggeredAcquisition.hh"
+#include "OutputFormats.hh"
+#include "TraceCodec.hh"
+#include "TraceKernels.hh"
+
+void usage() {
+      std::cout << "Usage:" << std::endl;
+      std::cout << "tracedecode [options] <tracefile> [<outputfile>]" << std::endl;
+      std::cout << std::endl;
+      std::cout << "Decodes a compact trace file written by 'acquisition -o 2'." << std::endl;
+      std::cout << "Per default, traces are written as text like 'acquisition -o 0'" << std::endl;
+      std::cout << "to <outputfile> or to the standard output." << std::endl;
+      std::cout << std::endl;
+      std::cout << "Options:" << std::endl;
+      std::cout << "   -b                     write binary file like 'acquisition -o 1'" << std::endl;
+      std::cout << "   -i                     only print header and statistics" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+  bool binary = false;
+  bool info = false;
+  std::vector<std::string> files;
+
+  for ( int i=1; i<argc; i=i+1 ) {
+    if ( std::string(argv[i]) == "-h" || std::string(argv[i]) == "--help") {
+      usage();
+      return 0;
+    }
+    else if ( std::string(argv[i]) == "-b" ) {
+      binary = true;
+    }
+    else if ( std::string(argv[i]) == "-i" ) {
+      info = true;
+    }
+    else {
+      files.push_back(argv[i]);
+    }
+  }
+  if(files.size() < 1) {
+    usage();
+    return -1;
+  }
+
+  FILE * in = fopen(files[0].c_str(), "rb");
+  if(!in) {
+    std::cout << "Error: Could not open " << files[0] << std::endl;
+    return -1;
+  }
+  TraceFileHeader header;
+  memset(&header, 0, sizeof(header));
+  const size_t fixed = 16; // magic, version and headersize
+  if(fread(&header, 1, fixed, in) != fixed || strncmp(header.magic, TRACEFILEMAGIC, sizeof(header.magic)) != 0
+     || header.headersize < fixed) {
+    std::cout << "Error: " << files[0] << " is not a trace file" << std::endl;
+    return -1;
+  }
+  // Newer versions may have a longer header, only the known part is read
+  size_t known = header.headersize < sizeof(header) ? header.headersize : sizeof(header);
+  if(fread((char *) &header + fixed, 1, known - fixed, in) != known - fixed
+     || fseek(in, header.headersize, SEEK_SET) != 0) {
+    std::cout << "Error: Truncated header" << std::endl;
+    return -1;
+  }
+  if(header.encoding != TRACE_ENCODING_DELTA_VARINT) {
+    std::cout << "Error: Unknown encoding " << header.encoding << std::endl;
+    return -1;
+  }
+  // The blocks end where the run footer starts (version 2 and later)
+  uint32_t footersize = header.version >= 2 ? header.footersize : 0;
+  fseek(in, 0, SEEK_END);
+  long blockend = ftell(in) - footersize;
+  RunFooter footer;
+  memset(&footer, 0, sizeof(footer));
+  bool hasfooter = false;
+  if(footersize >= sizeof(footer) && blockend >= (long) header.headersize) {
+    fseek(in, blockend, SEEK_SET);
+    hasfooter = fread(&footer, sizeof(footer), 1, in) == 1
+      && strncmp(footer.magic, RUNFOOTERMAGIC, sizeof(footer.magic)) == 0;
+  }
+  fseek(in, header.headersize, SEEK_SET);
+
+  FILE * out = stdout;
+  if(!info && files.size() > 1) {
+    out = fopen(files[1].c_str(), binary ? "wb" : "w");
+    if(!out) {
+      std::cout << "Error: Could not open " << files[1] << std::endl;
+      return -1;
+    }
+  }
+  if(!info) {
+    if(binary) {
+      fwrite(&header.decimation, sizeof(int), 1, out);
+      fwrite(&header.tracelength, sizeof(int), 1, out);
+      fwrite(&header.pretriggerlength, sizeof(int), 1, out);
+      fwrite(&header.triggervoltage, sizeof(float), 1, out);
+      fwrite(&header.trigger, sizeof(int), 1, out);
+    }
+    else {
+      // Same header as acquisition -o 0
+      std::string text = TriggeredAcquisition::textHeader(header.decimation, header.tracelength, header.pretriggerlength,
+							  header.triggervalue, (TriggerSetting) header.trigger);
+      fputs(text.c_str(), out);
+      if(header.channels != CHANNELS_A) {
+	fprintf(out, "Channels:             %s\n", TriggeredAcquisition::channelString((ChannelSetting) header.channels).c_str());
+      }
+    }
+  }
+
+  int n = header.tracelength;
+  std::vector<uint8_t> payload;
+  std::vector<int16_t> trace(n);
+  std::vector<int> raw(n);
+  uint64_t traces = 0;
+  uint64_t bytes = 0;
+  uint64_t blocks = 0;
+  TraceBlockHeader block;
+  while(ftell(in) + (long) sizeof(block) <= blockend && fread(&block, sizeof(block), 1, in) == 1) {
+    if(block.magic != TRACEBLOCKMAGIC || block.samples != block.traces * (uint32_t) n) {
+      std::cout << "Error: Corrupt block " << blocks << std::endl;
+      return -1;
+    }
+    payload.resize(block.bytes);
+    if(fread(payload.data(), 1, block.bytes, in) != block.bytes) {
+      std::cout << "Error: Truncated block " << blocks << std::endl;
+      return -1;
+    }
+    int pos = 0;
+    for(uint32_t t = 0; t < block.traces; t++) {
+      int used = DecodeTrace(payload.data() + pos, block.bytes - pos, n, trace.data());
+      if(used < 0) {
+	std::cout << "Error: Corrupt trace in block " << blocks << std::endl;
+	return -1;
+      }
+      pos += used;
+      if(info) {
+	continue;
+      }
+      if(binary) {
+	for(int i = 0; i < n; i++) {
+	  raw[i] = RawSample(trace[i]);
+	}
+	fwrite(raw.data(), sizeof(int), n, out);
+      }
+      else {
+	for(int i = 0; i < n; i++) {
+	  fprintf(out, "%d ", RawSample(trace[i]));
+	}
+	fprintf(out, "\n");
+      }
+    }
+    traces += block.traces;
+    bytes += block.bytes;
+    blocks++;
+  }
+  fclose(in);
+
+  if(info) {
+    std::cout << "Decimation:           " << header.decimation << std::endl;
+    std::cout << "Trace length:         " << header.tracelength << std::endl;
+    std::cout << "Pretrigger length:    " << header.pretriggerlength << std::endl;
+    std::cout << "Trigger Value:        " << header.triggervalue << std::endl;
+    std::cout << "Triggering on:        " << header.trigger << std::endl;
+    std::cout << "Channels:             " << header.channels << (header.channels == CHANNELS_BOTH ? " (A and B trace per event)" : "") << std::endl;
+    std::cout << "Blocks:               " << blocks << std::endl;
+    std::cout << "Traces:               " << traces << std::endl;
+    if(traces > 0) {
+      std::cout << "Bytes per sample:     " << 1.0 * bytes / (traces * n) << std::endl;
+    }
+    if(hasfooter) {
+      std::cout << "Events:               " << footer.events << std::endl;
+      std::cout << "Rejected:             " << footer.rejected << std::endl;
+      std::cout << "Real time [s]:        " << footer.realtime << std::endl;
+      std::cout << "Live time [s]:        " << footer.livetime << std::endl;
+      std::cout << "Dead time fraction:   " << footer.deadfraction << std::endl;
+    }
+  }
+  else if(out != stdout) {
+    fclose(out);
+  }
+  return 0;
+}